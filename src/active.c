@@ -0,0 +1,224 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file active.c
+ * @author James Clark
+ * @brief Active block tracking, to skip regions of the image that have converged.
+ *
+ * The local image is split in to square blocks. A block is skipped once it and its four
+ * neighbours have all changed by less than the threshold for ::ACTIVE_PATIENCE
+ * operations in a row, and becomes active again as soon as one of them changes.
+ * Blocks on the edge of the local image read the halos, so they are never skipped.
+ * A skipped block keeps reporting its last delta, so once the run appears converged
+ * every block is woken with ::active_wake and the stop is confirmed by full sweeps.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <mpi.h>
+
+#include <precision.h>
+#include <functions.h>
+
+/** Number of quiet operations before a block can be skipped */
+#define ACTIVE_PATIENCE 4
+
+/**
+ * @brief Set up the blocks, all of which start active
+ * @param active the blocks to set up
+ * @param img_dim the dimensions of the local and global data
+ * @param size the width and height of a block
+ * @param threshold blocks changing by less than this are quiet
+ */
+void active_init (active_blocks * active, image_dimensions img_dim, int size, real threshold) {
+    int b;
+
+    active->size = size;
+    active->bm = (img_dim.mp + size - 1)/size;
+    active->bn = (img_dim.np + size - 1)/size;
+    active->threshold = threshold;
+    active->computed = 0.0;
+    active->total = 0.0;
+
+    active->delta = (real *) malloc(active->bm*active->bn * sizeof(real));
+    active->sum   = (repro_sum *) malloc(active->bm*active->bn * sizeof(repro_sum));
+    active->square = (repro_sum *) malloc(active->bm*active->bn * sizeof(repro_sum));
+    active->quiet = (int *)  malloc(active->bm*active->bn * sizeof(int));
+    active->skip  = (char *) malloc(active->bm*active->bn * sizeof(char));
+
+    for (b = 0; b < active->bm*active->bn; b++) {
+        active->delta[b] = 0.0;
+        repro_zero(&(active->sum[b]));
+        repro_zero(&(active->square[b]));
+        active->quiet[b] = 0;
+        active->skip[b] = 0;
+    }
+}
+
+/**
+ * @brief Check if a block is on the edge of the local image
+ * @param active the blocks
+ * @param bi the block's position in dim 0
+ * @param bj the block's position in dim 1
+ * @return 1 if the block reads the halos, otherwise 0
+ */
+static int active_boundary (active_blocks * active, int bi, int bj) {
+    return (bi == 0) || (bi == active->bm-1) || (bj == 0) || (bj == active->bn-1);
+}
+
+/**
+ * @brief Reconstruct the active blocks of one kind in to new
+ * @param active the blocks
+ * @param img_dim the dimensions of the local and global data
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data
+ * @param new stores the current operation's data
+ * @param boundary 1 to sweep the blocks that read the halos, 0 to sweep the rest
+ */
+void active_sweep (active_blocks * active, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, int boundary) {
+    int bi, bj, b_end, i, j, i_end, j_start, j_end;
+
+    for (bi = 0; bi < active->bm; bi++) {
+        i_end = (bi+1)*active->size < img_dim.mp ? (bi+1)*active->size : img_dim.mp;
+
+        /* sweep runs of neighbouring blocks together, so the inner loop stays long */
+        for (bj = 0; bj < active->bn; bj = b_end) {
+            if (active->skip[bi*active->bn + bj] || active_boundary(active, bi, bj) != boundary) {
+                b_end = bj + 1;
+                continue;
+            }
+            for (b_end = bj + 1; b_end < active->bn; b_end++) {
+                if (active->skip[bi*active->bn + b_end] || active_boundary(active, bi, b_end) != boundary) break;
+            }
+
+            j_start = 1 + bj*active->size;
+            j_end = b_end*active->size < img_dim.np ? b_end*active->size : img_dim.np;
+            for (i = 1 + bi*active->size; i < i_end + 1; i++) {
+                for (j = j_start; j < j_end + 1; j++) {
+                    new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Set old = new for the active blocks, then choose the blocks for the next operation
+ * @param active the blocks
+ * @param img_dim the dimensions of the local and global data
+ * @param old stores the previous operation's data
+ * @param new stores the current operation's data
+ * @return the maximum pixel change, the sum of all pixels and the sum of squared changes. Skipped blocks give their last values
+ */
+step_return active_finish (active_blocks * active, image_dimensions img_dim, real ** old, real ** new) {
+    int b, bi, bj, i, j, i_end, j_end, quiet;
+    real delta;
+    step_return block, retval = {0.0};
+
+    for (bi = 0; bi < active->bm; bi++) {
+        for (bj = 0; bj < active->bn; bj++) {
+            b = bi*active->bn + bj;
+            i_end = (bi+1)*active->size < img_dim.mp ? (bi+1)*active->size : img_dim.mp;
+            j_end = (bj+1)*active->size < img_dim.np ? (bj+1)*active->size : img_dim.np;
+
+            if (!active->skip[b]) {
+                block.delta = 0.0;
+                repro_zero(&(block.sum));
+                repro_zero(&(block.square));
+                for (i = 1 + bi*active->size; i < i_end + 1; i++) {
+                    if (repro_wanted & REPRO_SQUARE)
+                        repro_add_squares(&(block.square), &(new[i][1 + bj*active->size]), &(old[i][1 + bj*active->size]), j_end - bj*active->size);
+                    for (j = 1 + bj*active->size; j < j_end + 1; j++) {
+                        delta = fabs(new[i][j] - old[i][j]);
+                        if (delta > block.delta) {
+                            block.delta = delta;
+                        }
+                        if (repro_wanted & REPRO_SUM) repro_add(&(block.sum), new[i][j]);
+                        old[i][j] = new[i][j];
+                    }
+                }
+                active->delta[b] = block.delta;
+                active->sum[b] = block.sum;
+                active->square[b] = block.square;
+                active->computed += (i_end - bi*active->size) * (j_end - bj*active->size);
+
+                if (active->delta[b] < active->threshold) active->quiet[b]++;
+                else active->quiet[b] = 0;
+            } else if (repro_wanted & REPRO_SUM) {
+                /* a skipped block still holds the pixels it was last summed with, but its
+                 * sum is only kept on the iterations that want it */
+                repro_zero(&(active->sum[b]));
+                for (i = 1 + bi*active->size; i < i_end + 1; i++) {
+                    for (j = 1 + bj*active->size; j < j_end + 1; j++) {
+                        repro_add(&(active->sum[b]), old[i][j]);
+                    }
+                }
+            }
+            active->total += (i_end - bi*active->size) * (j_end - bj*active->size);
+
+            if (active->delta[b] > retval.delta) retval.delta = active->delta[b];
+            if (repro_wanted & REPRO_SUM) repro_merge(&(retval.sum), &(active->sum[b]));
+            if (repro_wanted & REPRO_SQUARE) repro_merge(&(retval.square), &(active->square[b]));
+        }
+    }
+
+    /* skip blocks whose whole neighbourhood has been quiet */
+    for (bi = 0; bi < active->bm; bi++) {
+        for (bj = 0; bj < active->bn; bj++) {
+            b = bi*active->bn + bj;
+            if (active_boundary(active, bi, bj)) continue;
+
+            quiet = (active->quiet[b] >= ACTIVE_PATIENCE)
+                 && (active->quiet[b-active->bn] >= ACTIVE_PATIENCE)
+                 && (active->quiet[b+active->bn] >= ACTIVE_PATIENCE)
+                 && (active->quiet[b-1] >= ACTIVE_PATIENCE)
+                 && (active->quiet[b+1] >= ACTIVE_PATIENCE);
+            active->skip[b] = quiet;
+        }
+    }
+
+    return retval;
+}
+
+/**
+ * @brief Make every block active, and quiet for no operations, so none is skipped for the
+ *        next ::ACTIVE_PATIENCE operations
+ * @param active the blocks
+ */
+void active_wake (active_blocks * active) {
+    int b;
+
+    for (b = 0; b < active->bm*active->bn; b++) {
+        active->quiet[b] = 0;
+        active->skip[b] = 0;
+    }
+}
+
+/**
+ * @brief Free the blocks
+ * @param active the blocks to free
+ */
+void active_free (active_blocks * active) {
+    free(active->delta);
+    free(active->sum);
+    free(active->square);
+    free(active->quiet);
+    free(active->skip);
+}
@@ -23,6 +23,32 @@
 const char *argp_program_version =
   "reconstruct 0.1";
 
+/* Keys for options without a short name */
+#define OPT_ACTIVE_THRESHOLD 256
+#define OPT_SERVE 257
+#define OPT_SUBMIT 258
+#define OPT_STOP 259
+#define OPT_TRACE 260
+#define OPT_COUNTERS 261
+#define OPT_GRID 262
+#define OPT_CHECK_INTERVAL 263
+#define OPT_AUTOTUNE 264
+#define OPT_CONVERGE 265
+#define OPT_SNAPSHOT_EVERY 266
+#define OPT_SNAPSHOT 267
+#define OPT_OUT_OF_CORE 268
+#define OPT_ASYNC 269
+#define OPT_POLL_ROWS 270
+#define OPT_HALO_FLOAT 271
+#define OPT_BATCH 272
+#define OPT_METRICS 273
+#define OPT_BALANCE 274
+#define OPT_BALANCE_THRESHOLD 275
+#define OPT_IN_PLACE 276
+
+/* Default tuning cache for --autotune */
+#define TUNE_CACHE "reconstruct.tune"
+
 /*
    PARSER. Field 2 in ARGP.
    Order of parameters: KEY, ARG, STATE.
@@ -34,17 +60,116 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
     switch (key)
     {
         case 'i':
-            arguments->iterations = atoi(arg);
+            arguments->options.iterations = atoi(arg);
             break;
         case 's':
-            arguments->step = atoi(arg);
+            arguments->options.step = atoi(arg);
             break;
         case 'd':
-            arguments->delta = atof(arg);
+            arguments->options.delta = atof(arg);
             break;
         case 'o':
             arguments->output = arg;
             break;
+        case 'H':
+            if (strcmp(arg, "none") == 0) arguments->huge_pages = GRID_PAGES_NORMAL;
+            else if (strcmp(arg, "thp") == 0) arguments->huge_pages = GRID_PAGES_TRANSPARENT;
+            else if (strcmp(arg, "explicit") == 0) arguments->huge_pages = GRID_PAGES_EXPLICIT;
+            else argp_error(state, "MODE must be one of none, thp or explicit");
+            break;
+        case 't':
+            arguments->options.tile_depth = atoi(arg);
+            arguments->tuned_given = 1;
+            if (arguments->options.tile_depth < 1) argp_error(state, "TILE_DEPTH must be at least 1");
+            break;
+        case 'a':
+            arguments->options.active_block = atoi(arg);
+            if (arguments->options.active_block < 0) argp_error(state, "SIZE must not be negative");
+            break;
+        case OPT_ACTIVE_THRESHOLD:
+            arguments->options.active_threshold = atof(arg);
+            break;
+        case 'w':
+            arguments->options.warm_start = atoi(arg);
+            if (arguments->options.warm_start < 0) argp_error(state, "LEVELS must not be negative");
+            break;
+        case 'S':
+            arguments->stream = 1;
+            break;
+        case OPT_SERVE:
+            arguments->serve = arg;
+            break;
+        case OPT_SUBMIT:
+            arguments->submit = arg;
+            break;
+        case OPT_STOP:
+            arguments->stop = 1;
+            break;
+        case OPT_TRACE:
+            arguments->trace = arg;
+            break;
+        case OPT_COUNTERS:
+            arguments->counters = 1;
+            break;
+        case OPT_GRID:
+            if (sscanf(arg, "%dx%d", &(arguments->dims[0]), &(arguments->dims[1])) != 2
+                || arguments->dims[0] < 0 || arguments->dims[1] < 0)
+                argp_error(state, "GRID must be PxQ, 0 letting MPI choose that dimension");
+            arguments->tuned_given = 1;
+            break;
+        case OPT_CHECK_INTERVAL:
+            arguments->options.check_interval = atoi(arg);
+            arguments->tuned_given = 1;
+            if (arguments->options.check_interval < 1) argp_error(state, "INTERVAL must be at least 1");
+            break;
+        case OPT_CONVERGE:
+            if (strcmp(arg, "delta") == 0) arguments->options.stop = RECONSTRUCT_STOP_DELTA;
+            else if (strcmp(arg, "max") == 0) arguments->options.stop = RECONSTRUCT_STOP_RESIDUAL_MAX;
+            else if (strcmp(arg, "l2") == 0) arguments->options.stop = RECONSTRUCT_STOP_RESIDUAL_L2;
+            else if (strcmp(arg, "error") == 0) arguments->options.stop = RECONSTRUCT_STOP_ERROR;
+            else argp_error(state, "MEASURE must be one of delta, max, l2 or error");
+            break;
+        case OPT_SNAPSHOT_EVERY:
+            arguments->options.snapshot_every = atoi(arg);
+            if (arguments->options.snapshot_every < 0) argp_error(state, "N must not be negative");
+            break;
+        case OPT_SNAPSHOT:
+            arguments->options.snapshot = arg;
+            break;
+        case OPT_AUTOTUNE:
+            arguments->autotune = arg != NULL ? arg : TUNE_CACHE;
+            break;
+        case OPT_POLL_ROWS:
+            arguments->options.poll_rows = atoi(arg);
+            if (arguments->options.poll_rows < 0) argp_error(state, "ROWS must not be negative");
+            break;
+        case OPT_HALO_FLOAT:
+            arguments->options.halo_float = 1;
+            break;
+        case OPT_ASYNC:
+            arguments->options.async = 1;
+            break;
+        case OPT_OUT_OF_CORE:
+            arguments->out_of_core = arg;
+            break;
+        case OPT_BATCH:
+            arguments->batch = atoi(arg);
+            if (arguments->batch < 1) argp_error(state, "FRAMES must be at least 1");
+            break;
+        case OPT_METRICS:
+            arguments->metrics = arg;
+            break;
+        case OPT_BALANCE:
+            arguments->options.balance = atoi(arg);
+            if (arguments->options.balance < 1) argp_error(state, "ITERATIONS must be at least 1");
+            break;
+        case OPT_BALANCE_THRESHOLD:
+            arguments->options.balance_threshold = atof(arg);
+            if (arguments->options.balance_threshold < 0.0) argp_error(state, "FRACTION must not be negative");
+            break;
+        case OPT_IN_PLACE:
+            arguments->options.in_place = 1;
+            break;
         case ARGP_KEY_ARG:
             if (state->arg_num >= 1)
             {
@@ -53,10 +178,45 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
             arguments->filename = arg;
             break;
         case ARGP_KEY_END:
-            if (state->arg_num < 1)
+            if (state->arg_num < 1 && arguments->serve == NULL && !arguments->stop)
             {
                 argp_usage(state);
             }
+            if (arguments->options.active_block > 0 && arguments->options.tile_depth > 1)
+            {
+                argp_error(state, "--active_block cannot be combined with --tile_depth");
+            }
+            if (arguments->options.async && (arguments->options.tile_depth > 1 || arguments->options.active_block > 0
+                || arguments->options.stop != RECONSTRUCT_STOP_DELTA || arguments->options.snapshot_every > 0))
+            {
+                argp_error(state, "--async cannot be combined with --tile_depth, --active_block, --converge or --snapshot_every");
+            }
+            if (arguments->options.balance > 0 && (arguments->options.tile_depth > 1 || arguments->options.active_block > 0
+                || arguments->options.snapshot_every > 0 || arguments->options.async))
+            {
+                argp_error(state, "--balance cannot be combined with --tile_depth, --active_block, --snapshot_every or --async");
+            }
+            if (arguments->options.in_place && (arguments->options.tile_depth > 1 || arguments->options.active_block > 0
+                || arguments->options.async))
+            {
+                argp_error(state, "--in_place cannot be combined with --tile_depth, --active_block or --async");
+            }
+            if (arguments->autotune != NULL && arguments->tuned_given)
+            {
+                argp_error(state, "--autotune chooses --tile_depth, --check_interval and --grid, so cannot be combined with them");
+            }
+            if (arguments->out_of_core != NULL && (arguments->stream || arguments->serve != NULL || arguments->submit != NULL))
+            {
+                argp_error(state, "--out_of_core reconstructs a single edge_file");
+            }
+            if (arguments->batch > 0 && (!arguments->stream || arguments->out_of_core != NULL))
+            {
+                argp_error(state, "--batch needs --stream, and cannot be combined with --out_of_core");
+            }
+            if (arguments->stop && arguments->submit == NULL)
+            {
+                argp_error(state, "--stop needs --submit");
+            }
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -74,7 +234,33 @@ static struct argp_option options[] =
   {"max_iterations", 'i', "MAX_ITERATIONS", 0, "Manually specify the maximum number of iterations"},
   {"step", 's', "STEP", 0, "Manually specify the output step"},
   {"delta", 'd', "DELTA", 0, "Manually specify the minimum delta value"},
-  {"output_file", 'o', "FILE", 0, "Manually specify the output file"},
+  {"output_file", 'o', "FILE", 0, "Manually specify the output file, a printf pattern for the frame number with --stream"},
+  {"huge_pages", 'H', "MODE", 0, "Back large grids with huge pages: none, thp or explicit"},
+  {"active_block", 'a', "SIZE", 0, "Skip SIZE x SIZE blocks once they and their neighbours have converged"},
+  {"active_threshold", OPT_ACTIVE_THRESHOLD, "THRESHOLD", 0, "Blocks changing by less than THRESHOLD have converged (default and at most DELTA/100)"},
+  {"warm_start", 'w', "LEVELS", 0, "Start from a solve at LEVELS coarser resolutions, instead of white"},
+  {"stream", 'S', 0, 0, "edge_file holds a sequence of frames, or lists one frame file per line"},
+  {"serve", OPT_SERVE, "SOCKET", 0, "Start once and reconstruct the jobs sent to SOCKET, see --submit"},
+  {"submit", OPT_SUBMIT, "SOCKET", 0, "Send edge_file to the server on SOCKET, instead of reconstructing it here"},
+  {"stop", OPT_STOP, 0, 0, "With --submit, stop the server instead of sending a job"},
+  {"trace", OPT_TRACE, "FILE", 0, "Write a timeline of every process's events to FILE, to open in Perfetto"},
+  {"counters", OPT_COUNTERS, 0, 0, "Report hardware counters, bandwidth and a roofline for each rank"},
+  {"metrics", OPT_METRICS, "FILE", 0, "Keep the progress of the solve in FILE, ideally in /dev/shm, for reconstruct.monitor to show"},
+  {"grid", OPT_GRID, "PxQ", 0, "Lay the processes out P across and Q down the image, 0 lets MPI choose"},
+  {"check_interval", OPT_CHECK_INTERVAL, "INTERVAL", 0, "Check the global delta every INTERVAL iterations, overshooting by up to INTERVAL-1"},
+  {"converge", OPT_CONVERGE, "MEASURE", 0, "Stop once MEASURE is at most DELTA: delta (the largest change), max or l2 (residual norms), or error (the estimated RMS error)"},
+  {"snapshot_every", OPT_SNAPSHOT_EVERY, "N", 0, "Write the image every N iterations in the background, without stalling the solve"},
+  {"snapshot", OPT_SNAPSHOT, "FILE", 0, "printf pattern for the snapshots, given the iteration (default snapshot%06d.pgm)"},
+  {"poll_rows", OPT_POLL_ROWS, "ROWS", 0, "Test the halo swap every ROWS rows of the interior, so MPI moves the halos while it is swept, 0 to only wait"},
+  {"halo_float", OPT_HALO_FLOAT, 0, 0, "Swap halos as floats, halving the bytes sent, and confirm convergence with a full precision iteration"},
+  {"async", OPT_ASYNC, 0, 0, "Iterate with the newest halos instead of waiting for them, confirming convergence with a synchronised iteration"},
+  {"balance", OPT_BALANCE, "ITERATIONS", 0, "Measure each process's speed every ITERATIONS iterations, and repartition the image in proportion if they are uneven"},
+  {"balance_threshold", OPT_BALANCE_THRESHOLD, "FRACTION", 0, "With --balance, repartition once the slowest process is FRACTION slower than the mean (default 0.1)"},
+  {"in_place", OPT_IN_PLACE, 0, 0, "Update the image in place, keeping a few rows instead of a second copy of the image"},
+  {"out_of_core", OPT_OUT_OF_CORE, "DIR", 0, "Keep the image in scratch files in DIR, for images larger than memory, on one process"},
+  {"batch", OPT_BATCH, "FRAMES", 0, "With --stream, solve FRAMES frames at once in the vector lanes of one process, each from white"},
+  {"autotune", OPT_AUTOTUNE, "CACHE", OPTION_ARG_OPTIONAL, "Time candidates for --grid, -t and --check_interval and use the fastest, kept in CACHE (default " TUNE_CACHE ")"},
+  {"tile_depth", 't', "TILE_DEPTH", 0, "Advance TILE_DEPTH iterations per pass over memory (serial only)"},
   {0}
 };
 /* Documentation String */
@@ -0,0 +1,96 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file balance.c
+ * @author James Clark
+ * @brief Partitions the image in proportion to the speed of each process.
+ *
+ * The processes stay in a cartesian grid, so every process in a column of the grid has
+ * the same width and every process in a row the same height, and neighbours still share
+ * whole edges. If the speed of each process is the product of a factor for its column and
+ * one for its row, making each width proportional to its column's mean speed and each
+ * height to its row's gives every process the same time per iteration. Otherwise it is
+ * the nearest the grid allows, which on a P x 1 or 1 x Q grid is exact.
+ */
+
+#include <stdlib.h>
+
+#include <precision.h>
+#include <functions.h>
+
+/** The smallest tile width or height, so the boundary strips of an update do not overlap */
+#define BALANCE_MIN 4
+
+/**
+ * @brief Split one dimension of the image in proportion to some weights
+ * @param parts the number of tiles
+ * @param total the size of the image in this dim
+ * @param weight the weight of each tile
+ * @param cuts stores where each tile starts, then total
+ * @return 0 on success, or -1 if the tiles cannot all be BALANCE_MIN or more
+ */
+static int balance_split (int parts, int total, const real * weight, int * cuts) {
+    int k;
+    real sum = 0.0, cumulative = 0.0;
+
+    if (parts * BALANCE_MIN > total) return -1;
+    for (k = 0; k < parts; k++) sum += weight[k];
+
+    cuts[0] = 0;
+    for (k = 1; k < parts; k++) {
+        cumulative += weight[k-1];
+        cuts[k] = (int) (total * cumulative / sum + 0.5);
+        /* leave room for this tile and every one after it */
+        if (cuts[k] < cuts[k-1] + BALANCE_MIN) cuts[k] = cuts[k-1] + BALANCE_MIN;
+        if (cuts[k] > total - (parts - k) * BALANCE_MIN) cuts[k] = total - (parts - k) * BALANCE_MIN;
+    }
+    cuts[parts] = total;
+    return 0;
+}
+
+/**
+ * @brief Partition the image in proportion to the speed of each process
+ * @param dims the number of processes in each dimension
+ * @param m the width of the image
+ * @param n the height of the image
+ * @param size the number of processes
+ * @param coords the coordinates of each process, two each
+ * @param speed the pixels per second of each process
+ * @param cuts stores where the tiles start in dim 0, then m, then where they start in dim 1,
+ *        then n, so dims[0] + dims[1] + 2 values
+ * @return 0 on success, or -1 if the tiles would be too small to balance
+ */
+int balance_cuts (const int * dims, int m, int n, int size, const int * coords, const real * speed, int * cuts) {
+    int r, d, status;
+    real * weight[2];
+
+    /* the mean speed of each column and row of the process grid */
+    for (d = 0; d < 2; d++) weight[d] = (real *) calloc(dims[d], sizeof(real));
+    for (r = 0; r < size; r++) {
+        weight[0][coords[2*r]] += speed[r] / dims[1];
+        weight[1][coords[2*r+1]] += speed[r] / dims[0];
+    }
+
+    status = balance_split(dims[0], m, weight[0], cuts);
+    if (status == 0) status = balance_split(dims[1], n, weight[1], cuts + dims[0] + 1);
+
+    for (d = 0; d < 2; d++) free(weight[d]);
+    return status;
+}
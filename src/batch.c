@@ -0,0 +1,359 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file batch.c
+ * @author James Clark
+ * @brief Reconstructs a stream of small frames several at a time, on one process.
+ *
+ * A small image leaves most of a vector unit idle, as each row is too short to keep it
+ * busy for long. Here several frames of the same size are interleaved, pixel by pixel,
+ * so element [i][j*lanes + k] of a grid is pixel (i, j) of the frame in lane k, and one
+ * sweep over the grids updates every lane with the same vector instructions. Each lane
+ * keeps its own delta and iteration count, and once its frame converges the frame is
+ * written and the lane is given the next frame of the stream, so no lane waits for the
+ * slowest frame of its batch.
+ *
+ * Every pixel is computed with the same operands in the same order as ::update_tick, and
+ * each frame starts from white, so each output is identical to a run on that frame alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include <grid.h>
+#include <trace.h>
+#include <counters.h>
+#include <precision.h>
+#include <functions.h>
+
+/** The most frames solved at once */
+#define BATCH_LANES 64
+
+/** The state of a batch of frames */
+typedef struct {
+    int m;               /**< The width of every frame */
+    int n;               /**< The height of every frame */
+    int lanes;           /**< The number of frames solved at once */
+    edgenum ** edge;     /**< The edge data of every lane, interleaved */
+    real ** image[2];    /**< The current and next images of every lane, interleaved */
+    int * frame;         /**< The frame in each lane, -1 once the lane is idle */
+    int * iteration;     /**< The iterations each lane's frame has had */
+    real * delta;        /**< The largest change in each lane in the last iteration */
+} batch_state;
+
+/**
+ * @brief Set the sawtooth halos of every lane of both images. They never change, so are
+ *        set once for every frame
+ * @param state the batch
+ */
+static void batch_sawtooth (batch_state * state) {
+    int i, k, c, m = state->m, n = state->n, lanes = state->lanes;
+    real val;
+
+    for (c = 0; c < 2; c++) {
+        for (i = 1; i < m+1; i++) {
+            val = boundaryval(i, m);
+            for (k = 0; k < lanes; k++) {
+                state->image[c][i][k] = 255.0*val;
+                state->image[c][i][(n+1)*lanes + k] = 255.0*(1.0-val);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Allocate the interleaved grids, with every lane white and idle, and the
+ *        sawtooth in the halos of both images
+ * @param state the batch, with m, n and lanes set
+ */
+static void batch_init (batch_state * state) {
+    int i, j, k, c, m = state->m, n = state->n, lanes = state->lanes;
+
+    state->edge = (edgenum **) grid_alloc(sizeof(edgenum), m+2, (n+2)*lanes);
+    state->frame = (int *) malloc(lanes * sizeof(int));
+    state->iteration = (int *) malloc(lanes * sizeof(int));
+    state->delta = (real *) malloc(lanes * sizeof(real));
+
+    for (c = 0; c < 2; c++) {
+        state->image[c] = (real **) grid_alloc(sizeof(real), m+2, (n+2)*lanes);
+        for (i = 0; i < m+2; i++) {
+            for (j = 0; j < (n+2)*lanes; j++) {
+                state->image[c][i][j] = 255.0;
+            }
+        }
+    }
+    batch_sawtooth(state);
+    for (i = 0; i < m+2; i++) {
+        for (j = 0; j < (n+2)*lanes; j++) {
+            state->edge[i][j] = 0;
+        }
+    }
+    for (k = 0; k < lanes; k++) {
+        state->frame[k] = -1;
+        state->iteration[k] = 0;
+        state->delta[k] = 0.0;
+    }
+}
+
+/**
+ * @brief Free the grids of a batch
+ * @param state the batch
+ */
+static void batch_free (batch_state * state) {
+    grid_free(state->edge);
+    grid_free(state->image[0]);
+    grid_free(state->image[1]);
+    free(state->frame);
+    free(state->iteration);
+    free(state->delta);
+}
+
+/**
+ * @brief Put a frame in a lane, starting from white as ::setup_reconstruct does
+ * @param state the batch
+ * @param lane the lane
+ * @param current the image the next sweep starts from
+ * @param edge the frame's edge data, in the order of the file
+ */
+static void batch_load (batch_state * state, int lane, int current, const edgenum * edge) {
+    int i, j, m = state->m, n = state->n, lanes = state->lanes;
+
+    /* the grids hold columns, from the bottom of the image, see ::reconstruct_load */
+    for (i = 1; i < m+1; i++) {
+        for (j = 1; j < n+1; j++) {
+            state->edge[i][j*lanes + lane] = edge[(n-j)*m + i-1];
+            state->image[current][i][j*lanes + lane] = 255.0;
+        }
+    }
+    state->iteration[lane] = 0;
+}
+
+/**
+ * @brief Move the frames still being solved in to the first lanes, and sweep only those.
+ *        Once the stream has run out, the idle lanes would otherwise be swept until the
+ *        last frame converges.
+ * @param state the batch
+ * @param current the image the next sweep starts from
+ */
+static void batch_repack (batch_state * state, int current) {
+    int i, j, k, used, m = state->m, n = state->n, lanes = state->lanes;
+    int from[BATCH_LANES];
+    real ** image = state->image[current];
+
+    for (k = 0, used = 0; k < lanes; k++) {
+        if (state->frame[k] < 0) continue;
+        from[used] = k;
+        state->frame[used] = state->frame[k];
+        state->iteration[used] = state->iteration[k];
+        used++;
+    }
+
+    /* each pixel only moves to a lower index, so a pass in order never overwrites a pixel
+       it has still to move. The other image is all written by the next sweep */
+    for (i = 1; i < m+1; i++) {
+        for (j = 1; j < n+1; j++) {
+            for (k = 0; k < used; k++) {
+                image[i][j*used + k] = image[i][j*lanes + from[k]];
+                state->edge[i][j*used + k] = state->edge[i][j*lanes + from[k]];
+            }
+        }
+    }
+    state->lanes = used;
+    batch_sawtooth(state);
+}
+
+/**
+ * @brief Advance every lane by one iteration, finding the largest change in each
+ * @param state the batch
+ * @param old the images to start from, whose periodic halos are filled in
+ * @param new stores the images after the iteration
+ */
+static void batch_sweep (batch_state * state, real ** old, real ** new) {
+    int i, j, k, x, m = state->m, n = state->n, lanes = state->lanes;
+    edgenum ** edge = state->edge;
+    /* on the stack, so the compiler knows the stores to new cannot change it */
+    real delta[BATCH_LANES], change;
+    double t = trace_begin();
+
+    /* the periodic halos, a whole row of every lane at once */
+    memcpy(old[0] + lanes, old[m] + lanes, n*lanes * sizeof(real));
+    memcpy(old[m+1] + lanes, old[1] + lanes, n*lanes * sizeof(real));
+
+    for (k = 0; k < lanes; k++) delta[k] = 0.0;
+
+    counters_start();
+    for (i = 1; i < m+1; i++) {
+        for (j = 1; j < n+1; j++) {
+            /* one vectorised loop across the lanes of a pixel. new is never old, so
+               there is no need to check they overlap before every pixel */
+#pragma GCC ivdep
+            for (k = 0; k < lanes; k++) {
+                x = j*lanes + k;
+                new[i][x] = 0.25 * (old[i-1][x] + old[i+1][x] + old[i][x-lanes] + old[i][x+lanes] - edge[i][x]);
+                change = fabs(new[i][x] - old[i][x]);
+                delta[k] = change > delta[k] ? change : delta[k];
+            }
+        }
+    }
+    counters_stop(COUNTERS_STENCIL, m*n*lanes);
+
+    for (k = 0; k < lanes; k++) state->delta[k] = delta[k];
+    trace_end("sweep", t);
+}
+
+/**
+ * @brief Write the image in a lane, scaled as a run on the frame alone would be
+ * @param state the batch
+ * @param lane the lane
+ * @param current the image holding the lane's result
+ * @param filename the file to write
+ * @param tile a grid of the frame's size with halos, to copy the lane in to
+ * @param grey a grid of grey levels of the frame's size with halos
+ * @param grey_buf a grid of grey levels of the frame's size
+ * @return the average pixel of the image
+ */
+static real batch_save (batch_state * state, int lane, int current, char * filename,
+                        real ** tile, greynum ** grey, greynum ** grey_buf) {
+    int i, j, m = state->m, n = state->n, lanes = state->lanes;
+    image_dimensions img_dim = {m, n, m, n};
+    real xmin, xmax;
+    repro_sum sum;
+
+    for (i = 1; i < m+1; i++) {
+        for (j = 1; j < n+1; j++) {
+            tile[i][j] = state->image[current][i][j*lanes + lane];
+        }
+    }
+
+    grey_range(img_dim, tile, &xmin, &xmax);
+    grey_scale(img_dim, tile, xmin, xmax, grey);
+    for (i = 0; i < m; i++) {
+        for (j = 0; j < n; j++) {
+            grey_buf[i][j] = grey[i+1][j+1];
+        }
+    }
+    if (image_write(0, filename, img_dim, grey_buf) != 0) m_abort();
+
+    tile_sum(img_dim, tile, &sum);
+    return repro_value(&sum) / (m * n);
+}
+
+/**
+ * @brief Reconstruct a stream of frames several at a time, on one process. Each frame
+ *        starts from white, rather than from the frame before as with --stream alone
+ * @param filename the container or list file, see ::stream_open
+ * @param output printf pattern for the output files, given the frame number
+ * @param m the width of every frame
+ * @param n the height of every frame
+ * @param lanes the number of frames to solve at once
+ * @param options the options, see ::reconstruct_default_options. Only iterations, delta,
+ *        step and check_interval are used
+ * @return 0 on success, or -1 if the options are not supported in a batch
+ */
+int batch_solve (char * filename, char * output, int m, int n, int lanes, const reconstruct_options * options) {
+    batch_state state;
+    int k, it, checked, current, more, frames = 0, active = 0, total_iterations = 0;
+    char path[FILENAME_MAX];
+    edgenum * next_frame;
+    real ** tile;
+    greynum ** grey, ** grey_buf;
+    real average;
+    double t0, t1;
+
+    if (options->tile_depth > 1 || options->active_block > 0 || options->warm_start > 0
+        || options->stop != RECONSTRUCT_STOP_DELTA || options->snapshot_every > 0 || options->async)
+        return -1;
+    if (lanes > BATCH_LANES) lanes = BATCH_LANES;
+
+    state.m = m;
+    state.n = n;
+    state.lanes = lanes;
+    batch_init(&state);
+    tile = (real **) grid_alloc(sizeof(real), m+2, n+2);
+    grey = (greynum **) grid_alloc(sizeof(greynum), m+2, n+2);
+    grey_buf = (greynum **) grid_alloc(sizeof(greynum), m, n);
+    next_frame = (edgenum *) malloc(m*n * sizeof(edgenum));
+
+    printf("Batching %d x %d frames %d at a time from file: %s\n", m, n, lanes, filename);
+    t0 = get_time();
+    stream_open(filename, (image_dimensions) {m, n, m, n});
+
+    /* fill the lanes. From here on a read is in flight while there may be more frames */
+    current = 0;
+    stream_read(next_frame);
+    more = 1;
+    for (k = 0; k < lanes && more; k++) {
+        if ((more = stream_wait())) {
+            batch_load(&state, k, current, next_frame);
+            state.frame[k] = frames++;
+            active++;
+            stream_read(next_frame);
+        }
+    }
+
+    while (active > 0) {
+        batch_sweep(&state, state.image[current], state.image[1-current]);
+        current = 1-current;
+
+        for (k = 0; k < state.lanes; k++) {
+            if (state.frame[k] < 0) continue;
+
+            /* the iterations ::reconstruct_solve would check the delta on */
+            it = state.iteration[k]++;
+            checked = (it + 1) % options->check_interval == 0 || it + 1 == options->iterations
+                || (options->step > 0 && it % options->step == 0);
+            if (!(checked && state.delta[k] <= options->delta) && state.iteration[k] < options->iterations)
+                continue;
+
+            snprintf(path, sizeof(path), output, state.frame[k]);
+            average = batch_save(&state, k, current, path, tile, grey, grey_buf);
+            printf("Frame %d took %d iterations\tAverage Pixel = %.16f\tDelta = %.16f\n",
+                state.frame[k], state.iteration[k], average, state.delta[k]);
+            total_iterations += state.iteration[k];
+
+            /* retire the lane, giving it the next frame if there is one */
+            if (more && (more = stream_wait())) {
+                batch_load(&state, k, current, next_frame);
+                state.frame[k] = frames++;
+                stream_read(next_frame);
+            } else {
+                state.frame[k] = -1;
+                active--;
+            }
+        }
+
+        if (!more && active > 0 && active <= state.lanes / 2) batch_repack(&state, current);
+    }
+
+    t1 = get_time();
+    stream_close();
+    printf("Batched %d frames in %lf s: %.2f frames/s, %.1f iterations per frame\n",
+        frames, t1-t0, frames/(t1-t0), frames > 0 ? (real) total_iterations/frames : 0.0);
+
+    free(next_frame);
+    grid_free(tile);
+    grid_free(grey);
+    grid_free(grey_buf);
+    batch_free(&state);
+    return 0;
+}
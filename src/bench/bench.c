@@ -0,0 +1,396 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench/bench.c
+ * @author James Clark
+ * @brief Microbenchmarks for the parts of the reconstruction, see bench/compare.py.
+ *
+ * Each benchmark is repeated and the fastest repeat is kept, which is the least
+ * disturbed by the rest of the machine. The results are written as JSON by rank 0,
+ * with whether lower or higher values are better, so a baseline can be compared.
+ * Runs on any number of processes, the halo benchmarks need at least 2, and the image
+ * benchmarks a process grid that divides 768; those that cannot run say so.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <float.h>
+#include <mpi.h>
+#include <argp.h>
+
+#include <grid.h>
+#include <pgmio.h>
+#include <precision.h>
+#include <functions.h>
+
+/** Default number of repeats of each benchmark */
+#define REPEATS 5
+/** Iterations timed in each repeat of the stencil benchmark */
+#define STENCIL_ITERATIONS 50
+/** Round trips timed in each repeat of the halo benchmarks */
+#define HALO_TRIPS 200
+/** Reductions timed in each repeat of the reduce benchmark */
+#define REDUCE_CALLS 1000
+/** Width of the tile the column halos are taken from */
+#define HALO_WIDTH 512
+/** Size of the image for the scatter, gather and file benchmarks */
+#define IMAGE_SIZE 768
+/** Default JSON output file */
+#define OUTPUT "bench.json"
+
+/** Holds the arguments for the benchmarks */
+typedef struct {
+    char * output;   /**< JSON output file */
+    int repeats;     /**< Number of repeats of each benchmark */
+} bench_args;
+
+/** The JSON output, only on rank 0 */
+static FILE * json = NULL;
+/** Whether a result has been written yet */
+static int results = 0;
+
+/**
+ * @brief Write a result on rank 0
+ * @param rank the rank of the calling process
+ * @param name the name of the benchmark
+ * @param unit the unit of value
+ * @param value the result
+ * @param lower 1 if lower values are better, 0 if higher values are better
+ */
+static void bench_result (int rank, const char * name, const char * unit, double value, int lower) {
+    if (rank != 0) return;
+
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, \"better\": \"%s\"}",
+        results++ ? "," : "", name, unit, value, lower ? "lower" : "higher");
+    printf("%-28s %12.4f %s\n", name, value, unit);
+    fflush(stdout);
+}
+
+/**
+ * @brief Time update_tick on one process, for a square tile of each size
+ * @param rank the rank of the calling process
+ * @param repeats the number of repeats
+ */
+static void bench_stencil (int rank, int repeats) {
+    static const int sizes[] = {64, 128, 256, 512, 1024};
+    int s, r, i, j, k, dims[2] = {0,0}, self_rank, self_size;
+    char name[64];
+    double t, best;
+    image_dimensions img_dim = {0};
+    MPI_Comm self;
+    edgenum ** edge;
+    real ** old, ** new;
+    update_state * state;
+
+    get_cart_comm(MPI_COMM_SELF, &self_rank, &self_size, dims, &self);
+    state = update_state_create();
+
+    for (s = 0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); s++) {
+        img_dim.m = img_dim.mp = sizes[s];
+        img_dim.n = img_dim.np = sizes[s];
+        edge = (edgenum **) grid_alloc(sizeof(edgenum), img_dim.mp+2, img_dim.np+2);
+        old  = (real **) grid_alloc(sizeof(real), img_dim.mp+2, img_dim.np+2);
+        new  = (real **) grid_alloc(sizeof(real), img_dim.mp+2, img_dim.np+2);
+        for (i = 0; i < img_dim.mp+2; i++) {
+            for (j = 0; j < img_dim.np+2; j++) edge[i][j] = (edgenum) ((i*7 + j*13) % 64 - 32);
+        }
+        setup_reconstruct(self, self_rank, img_dim, old);
+
+        best = DBL_MAX;
+        for (r = 0; r < repeats; r++) {
+            t = get_time();
+            for (k = 0; k < STENCIL_ITERATIONS; k++) update_tick(self, self_rank, img_dim, edge, old, new, state);
+            t = get_time() - t;
+            if (t < best) best = t;
+        }
+        sprintf(name, "stencil_%d", sizes[s]);
+        bench_result(rank, name, "ns/pixel", 1.e9*best/((double) STENCIL_ITERATIONS*img_dim.mp*img_dim.np), 1);
+
+        halo_release(state);
+        grid_free(edge);
+        grid_free(old);
+        grid_free(new);
+    }
+    update_state_free(state);
+    free_cart_comm(&self);
+}
+
+/**
+ * @brief Wait for every process to reach this point, sleeping rather than spinning in MPI
+ *        so the processes being timed keep their cores when they are oversubscribed
+ * @param comm the communicator
+ */
+static void bench_idle (MPI_Comm comm) {
+    int done = 0;
+    MPI_Request request;
+
+    MPI_Ibarrier(comm, &request);
+    while (!done) {
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+        if (!done) usleep(1000);
+    }
+}
+
+/**
+ * @brief Time round trips between ranks 0 and 1, as a contiguous row halo and as a
+ *        strided column halo, for a range of halo lengths
+ * @param comm the communicator
+ * @param rank the rank of the calling process
+ * @param size the number of processes
+ * @param repeats the number of repeats
+ */
+static void bench_halo (MPI_Comm comm, int rank, int size, int repeats) {
+    static const int lengths[] = {1, 64, 1024, 16384};
+    static const char * kinds[] = {"row", "column"};
+    int l, c, r, k, n, peer;
+    char name[64];
+    double t, best;
+    real ** rows, ** cols;
+    MPI_Datatype column;
+    MPI_Request requests[2];
+
+    if (size < 2) {
+        if (rank == 0) printf("Skipping the halo benchmarks, they need at least 2 processes\n");
+        return;
+    }
+    if (rank > 1) {
+        bench_idle(comm);
+        return;
+    }
+    peer = 1 - rank;
+
+    for (l = 0; l < (int) (sizeof(lengths)/sizeof(lengths[0])); l++) {
+        n = lengths[l];
+        /* a row halo of n, or a column halo of n down a tile HALO_WIDTH wide */
+        rows = (real **) grid_alloc(sizeof(real), 2, n+2);
+        cols = (real **) grid_alloc(sizeof(real), n+2, HALO_WIDTH+2);
+        MPI_Type_vector(n, 1, grid_stride(cols), MPI_REALNUM, &column);
+        MPI_Type_commit(&column);
+
+        for (c = 0; c < 2; c++) {
+            best = DBL_MAX;
+            for (r = 0; r < repeats; r++) {
+                MPI_Sendrecv(NULL, 0, MPI_BYTE, peer, 0, NULL, 0, MPI_BYTE, peer, 0, comm, MPI_STATUS_IGNORE);
+                t = get_time();
+                for (k = 0; k < HALO_TRIPS; k++) {
+                    /* both ranks swap at once, as neighbours do in update_tick */
+                    if (c == 0) {
+                        MPI_Issend(&rows[1][1], n, MPI_REALNUM, peer, 1, comm, &requests[0]);
+                        MPI_Irecv(&rows[0][1], n, MPI_REALNUM, peer, 1, comm, &requests[1]);
+                    } else {
+                        MPI_Issend(&cols[1][1], 1, column, peer, 1, comm, &requests[0]);
+                        MPI_Irecv(&cols[1][0], 1, column, peer, 1, comm, &requests[1]);
+                    }
+                    MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+                }
+                t = get_time() - t;
+                if (t < best) best = t;
+            }
+            sprintf(name, "halo_%s_%d_latency", kinds[c], n);
+            bench_result(rank, name, "us", 1.e6*best/HALO_TRIPS, 1);
+            if (n >= 1024) {
+                sprintf(name, "halo_%s_%d_bandwidth", kinds[c], n);
+                bench_result(rank, name, "GB/s", 2.0*n*sizeof(real)*HALO_TRIPS/best/1.e9, 0);
+            }
+        }
+
+        MPI_Type_free(&column);
+        grid_free(rows);
+        grid_free(cols);
+    }
+    bench_idle(comm);
+}
+
+/**
+ * @brief Time the reduce used every iteration
+ * @param comm the communicator
+ * @param rank the rank of the calling process
+ * @param repeats the number of repeats
+ */
+static void bench_reduce (MPI_Comm comm, int rank, int repeats) {
+    int r, k;
+    double t, best = DBL_MAX;
+    real local = rank, global;
+
+    for (r = 0; r < repeats; r++) {
+        reduce(comm, MPI_MAX, &local, &global);
+        t = get_time();
+        for (k = 0; k < REDUCE_CALLS; k++) reduce(comm, MPI_MAX, &local, &global);
+        t = get_time() - t;
+        /* the slowest rank sets the pace */
+        reduce(comm, MPI_MAX, &t, &global);
+        if (global < best) best = global;
+    }
+    bench_result(rank, "reduce", "us", 1.e6*best/REDUCE_CALLS, 1);
+}
+
+/**
+ * @brief Time scatter_data and gather_data, then writing and reading the image
+ * @param rank the rank of the calling process
+ * @param size the number of processes
+ * @param repeats the number of repeats
+ */
+static void bench_image (int rank, int size, int repeats) {
+    int r, i, j, dims[2] = {0,0}, cart_rank, cart_size;
+    char filename[64];
+    double t, best_scatter = DBL_MAX, best_gather = DBL_MAX, best_write = DBL_MAX, best_read = DBL_MAX;
+    real local, global;
+    image_dimensions img_dim = {0};
+    MPI_Comm cart_comm;
+    edgenum ** main_buf = NULL, ** edge;
+    greynum ** grey_buf = NULL, ** grey;
+
+    get_cart_comm(MPI_COMM_WORLD, &cart_rank, &cart_size, dims, &cart_comm);
+    img_dim.m = IMAGE_SIZE;
+    img_dim.n = IMAGE_SIZE;
+    if (IMAGE_SIZE % dims[0] != 0 || IMAGE_SIZE % dims[1] != 0) {
+        if (rank == 0) {
+            printf("Skipping the image benchmarks, %d is not divisible by the %dx%d process grid\n", IMAGE_SIZE, dims[0], dims[1]);
+        }
+        free_cart_comm(&cart_comm);
+        return;
+    }
+    img_dim.mp = img_dim.m/dims[0];
+    img_dim.np = img_dim.n/dims[1];
+
+    if (cart_rank == 0) {
+        main_buf = (edgenum **) grid_alloc(sizeof(edgenum), img_dim.m, img_dim.n);
+        grey_buf = (greynum **) grid_alloc(sizeof(greynum), img_dim.m, img_dim.n);
+        for (i = 0; i < img_dim.m; i++) {
+            for (j = 0; j < img_dim.n; j++) {
+                main_buf[i][j] = (edgenum) ((i + j) % 256 - 128);
+                grey_buf[i][j] = (greynum) ((i * j) % 256);
+            }
+        }
+    }
+    edge = (edgenum **) grid_alloc(sizeof(edgenum), img_dim.mp+2, img_dim.np+2);
+    grey = (greynum **) grid_alloc(sizeof(greynum), img_dim.mp+2, img_dim.np+2);
+
+    for (r = 0; r < repeats; r++) {
+        t = get_time();
+        scatter_data(cart_comm, cart_rank, cart_size, img_dim, edge, main_buf);
+        local = get_time() - t;
+        reduce(cart_comm, MPI_MAX, &local, &global);
+        if (global < best_scatter) best_scatter = global;
+
+        t = get_time();
+        gather_data(cart_comm, cart_rank, cart_size, img_dim, grey, grey_buf);
+        local = get_time() - t;
+        reduce(cart_comm, MPI_MAX, &local, &global);
+        if (global < best_gather) best_gather = global;
+    }
+    bench_result(rank, "scatter_768", "ms", 1.e3*best_scatter, 1);
+    bench_result(rank, "gather_768", "ms", 1.e3*best_gather, 1);
+
+    /* only rank 0 touches files */
+    if (cart_rank == 0) {
+        sprintf(filename, "/tmp/reconstruct-bench-%d.pgm", (int) getpid());
+        for (r = 0; r < repeats; r++) {
+            t = get_time();
+            pgmwritegrey(filename, grey_buf, img_dim.m, img_dim.n);
+            t = get_time() - t;
+            if (t < best_write) best_write = t;
+
+            t = get_time();
+            pgmreadedge(filename, main_buf, img_dim.m, img_dim.n);
+            t = get_time() - t;
+            if (t < best_read) best_read = t;
+        }
+        unlink(filename);
+    }
+    /* the file benchmarks are passed on from the process that ran them */
+    local = cart_rank == 0 ? best_write : 0.0;
+    reduce(cart_comm, MPI_MAX, &local, &best_write);
+    local = cart_rank == 0 ? best_read : 0.0;
+    reduce(cart_comm, MPI_MAX, &local, &best_read);
+    bench_result(rank, "pgmwrite_768", "ms", 1.e3*best_write, 1);
+    bench_result(rank, "pgmread_768", "ms", 1.e3*best_read, 1);
+
+    if (cart_rank == 0) {
+        grid_free(main_buf);
+        grid_free(grey_buf);
+    }
+    grid_free(edge);
+    grid_free(grey);
+    free_cart_comm(&cart_comm);
+}
+
+static error_t parse_opt (int key, char * arg, struct argp_state * state) {
+    bench_args * arguments = state->input;
+
+    switch (key) {
+        case 'o':
+            arguments->output = arg;
+            break;
+        case 'r':
+            arguments->repeats = atoi(arg);
+            if (arguments->repeats < 1) argp_error(state, "REPEATS must be at least 1");
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp_option options[] = {
+    {"output_file", 'o', "FILE", 0, "Write the JSON results to FILE, default " OUTPUT},
+    {"repeats", 'r', "REPEATS", 0, "Keep the fastest of REPEATS runs of each benchmark"},
+    {0}
+};
+
+static struct argp argp = {options, parse_opt, 0, "microbenchmarks for reconstruct, written as JSON"};
+
+int main (int argc, char * argv[]) {
+    int rank, size;
+    char host[256];
+    bench_args arguments = {OUTPUT, REPEATS};
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    init(argc, argv, &rank, &size);
+
+    if (rank == 0) {
+        json = fopen(arguments.output, "w");
+        if (json == NULL) {
+            fprintf(stderr, "bench: cannot open <%s>\n", arguments.output);
+            m_abort();
+        }
+        if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+        fprintf(json, "{\n  \"host\": \"%s\",\n  \"processes\": %d,\n  \"repeats\": %d,\n  \"results\": [",
+            host, size, arguments.repeats);
+    }
+
+    bench_stencil(rank, arguments.repeats);
+    bench_halo(MPI_COMM_WORLD, rank, size, arguments.repeats);
+    bench_reduce(MPI_COMM_WORLD, rank, arguments.repeats);
+    bench_image(rank, size, arguments.repeats);
+
+    if (rank == 0) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+        printf("Results written to %s\n", arguments.output);
+    }
+
+    grid_release();
+    finalise();
+    return 0;
+}
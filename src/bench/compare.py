@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# MPP Coursework - MPI Edge Reconstruction
+# Copyright (C) 2015,2016 James Clark
+#
+# This file is part of MPP Coursework.
+#
+# MPP Coursework is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# MPP Coursework is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Compare the results of reconstruct.bench against a stored baseline.
+
+Prints the change in every benchmark found in both files, and exits with 1 if
+any got worse by more than the threshold, or any in the baseline is missing from
+the current results, so it can gate a build.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(filename):
+    with open(filename) as f:
+        data = json.load(f)
+    return data, {r["name"]: r for r in data["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", help="JSON results to compare against")
+    parser.add_argument("current", help="JSON results to check")
+    parser.add_argument("-t", "--threshold", type=float, default=10.0,
+                        help="percentage a benchmark may get worse by, default 10")
+    args = parser.parse_args()
+
+    base_data, base = load(args.baseline)
+    current_data, current = load(args.current)
+
+    for key in ("host", "processes"):
+        if base_data.get(key) != current_data.get(key):
+            print("Warning: %s differs, %s against %s"
+                  % (key, base_data.get(key), current_data.get(key)))
+
+    regressions = 0
+    print("%-28s %12s %12s %9s" % ("benchmark", "baseline", "current", "change"))
+    for name, result in current.items():
+        if name not in base:
+            print("%-28s %12s %12.4f %9s" % (name, "-", result["value"], "new"))
+            continue
+        old = base[name]["value"]
+        new = result["value"]
+        change = 100.0 * (new - old) / old if old else 0.0
+        # positive when the benchmark got worse
+        worse = change if result["better"] == "lower" else -change
+        flag = ""
+        if worse > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-28s %12.4f %12.4f %+8.1f%%%s" % (name, old, new, change, flag))
+
+    missing = 0
+    for name in base:
+        if name not in current:
+            print("%-28s %12.4f %12s %9s" % (name, base[name]["value"], "-", "missing"))
+            missing += 1
+
+    if missing:
+        print("%d benchmark(s) of the baseline missing from the current results" % missing)
+    if regressions:
+        print("%d regression(s) beyond %g%%" % (regressions, args.threshold))
+    if regressions or missing:
+        return 1
+    print("No regressions beyond %g%%" % args.threshold)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
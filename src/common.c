@@ -24,9 +24,11 @@
  */
 
 #include <stdio.h>
+#include <math.h>
 #include <mpi.h>
 
 #include <pgmio.h>
+#include <trace.h>
 #include <precision.h>
 #include <functions.h>
 
@@ -65,6 +67,101 @@ void setup_reconstruct (MPI_Comm cart_comm, int rank, image_dimensions img_dim,
     sawtooth(cart_comm, rank, img_dim, old);
 }
 
+/**
+ * @brief Copy the local data of one tile to another, including the sawtooth halos
+ * @param img_dim the dimensions of the local and global data
+ * @param src the tile to copy from
+ * @param dst the tile to copy to
+ */
+void copy_tile (image_dimensions img_dim, real ** src, real ** dst) {
+    int i, j;
+
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        for (j = 0; j < (img_dim.np + 2); j++) {
+            dst[i][j] = src[i][j];
+        }
+    }
+}
+
+/**
+ * @brief Add up the local data, see ::repro_sum
+ * @param img_dim the dimensions of the local and global data
+ * @param old the local data
+ * @param sum stores the sum
+ */
+void tile_sum (image_dimensions img_dim, real ** old, repro_sum * sum) {
+    int i, j;
+
+    repro_zero(sum);
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        for (j = 1; j < (img_dim.np + 1); j++) {
+            repro_add(sum, old[i][j]);
+        }
+    }
+}
+
+/**
+ * @brief Find the range of the absolute values of the local data
+ * @param img_dim the dimensions of the local and global data
+ * @param old the local data
+ * @param xmin stores the smallest absolute value
+ * @param xmax stores the largest absolute value
+ */
+void grey_range (image_dimensions img_dim, real ** old, real * xmin, real * xmax) {
+    int i, j;
+
+    *xmin = fabs(old[1][1]);
+    *xmax = fabs(old[1][1]);
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        for (j = 1; j < (img_dim.np + 1); j++) {
+            if (fabs(old[i][j]) < *xmin) *xmin = fabs(old[i][j]);
+            if (fabs(old[i][j]) > *xmax) *xmax = fabs(old[i][j]);
+        }
+    }
+}
+
+/**
+ * @brief Scale the local data to grey levels, given the range of the whole image
+ * @param img_dim the dimensions of the local and global data
+ * @param old the local data to scale
+ * @param xmin the smallest absolute value in the image
+ * @param xmax the largest absolute value in the image
+ * @param grey the array to store the grey levels in
+ */
+void grey_scale (image_dimensions img_dim, real ** old, real xmin, real xmax, greynum ** grey) {
+    int i, j;
+    real fval;
+    real thresh = 255.0;
+
+    if (xmin == xmax) xmin = xmax-1.0;
+
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        for (j = 1; j < (img_dim.np + 1); j++) {
+            fval = thresh*((fabs(old[i][j])-xmin)/(xmax-xmin))+0.5;
+            grey[i][j] = (greynum) fval;
+        }
+    }
+}
+
+/**
+ * @brief Scale the local data to grey levels, using the global range of the image.
+ *        Matches the scaling pgmwrite does on the whole image.
+ * @param cart_comm the cartesian communicator for the processes
+ * @param img_dim the dimensions of the local and global data
+ * @param old the local data to scale
+ * @param grey the array to store the grey levels in
+ */
+void quantise (MPI_Comm cart_comm, image_dimensions img_dim, real ** old, greynum ** grey) {
+    real local_min, local_max, xmin, xmax;
+
+    /* find the local max and min absolute values, then the global ones */
+    grey_range(img_dim, old, &local_min, &local_max);
+    reduce(cart_comm, MPI_MIN, &local_min, &xmin);
+    reduce(cart_comm, MPI_MAX, &local_max, &xmax);
+
+    grey_scale(img_dim, old, xmin, xmax, grey);
+}
+
 /**
  * @brief Get the dimensions of an image (Wrapper for pgmsize)
  * @param filename the file to find the dimensions of
@@ -76,29 +173,53 @@ void image_size (char *filename, int *nx, int *ny) {
 }
 
 /**
- * @brief Read in a PGM file to an array. Only rank 0 can read (Wrapper for pgmread)
+ * @brief Check an image's header and get its dimensions (Wrapper for pgmsizecheck)
+ * @param filename the file to check
+ * @param nx pointer to store the x dimension
+ * @param ny pointer to store the y dimension
+ * @return 0, or -1 if the file cannot be opened or has no valid header
+ */
+int image_check (char *filename, int *nx, int *ny) {
+    return pgmsizecheck(filename, nx, ny);
+}
+
+/**
+ * @brief Read in a PGM file to an array. Only rank 0 can read (Wrapper for pgmreadedgecheck)
  * @param rank the rank of the calling process
  * @param filename the file to read
  * @param img_dim the dimensions of the image
  * @param data the array to read the image in to
+ * @return 0, or -1 on rank 0 if the file is missing, malformed, the wrong size or truncated
  */
-void image_read (int rank, char * filename, image_dimensions img_dim, real ** data) {
+int image_read (int rank, char * filename, image_dimensions img_dim, edgenum ** data) {
+    double t;
+    int status = 0;
+
     if (rank == 0) {
+        t = trace_begin();
         printf("Reading %d x %d picture from file: %s\n", img_dim.m, img_dim.n, filename);
-        pgmread(filename, &data[0][0], img_dim.m, img_dim.n);
+        status = pgmreadedgecheck(filename, data, img_dim.m, img_dim.n);
+        trace_end("read", t);
     }
+    return status;
 }
 
 /**
- * @brief Write a PGM file from an array. Only rank 0 can write (Wrapper for pgmwrite)
+ * @brief Write a PGM file from an array. Only rank 0 can write (Wrapper for pgmwritegreycheck)
  * @param rank the rank of the calling process
  * @param filename the file to write to
  * @param img_dim the dimensions of the image
- * @param data the array to write to disk
+ * @param data the grey levels to write to disk, see ::quantise
+ * @return 0, or -1 on rank 0 if the file cannot be written
  */
- void image_write (int rank, char * filename, image_dimensions img_dim, real ** data) {
+int image_write (int rank, char * filename, image_dimensions img_dim, greynum ** data) {
+    double t;
+    int status = 0;
+
     if (rank == 0) {
-        pgmwrite(filename, &data[0][0], img_dim.m, img_dim.n);
+        t = trace_begin();
+        status = pgmwritegreycheck(filename, data, img_dim.m, img_dim.n);
+        trace_end("write", t);
     }
-
+    return status;
 }
@@ -0,0 +1,255 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file counters.c
+ * @author James Clark
+ * @brief Hardware counters and a roofline report for the phases of ::update_tick.
+ *
+ * Cycles, instructions and last level cache misses are read with perf_event_open,
+ * where the kernel allows it, otherwise only the time is measured. The report compares
+ * each rank's achieved bandwidth with a STREAM triad run by every rank at once, so it
+ * is the share of the node's bandwidth a rank can expect. The bytes and flops of each
+ * phase come from a model of the loops, which assumes the neighbouring rows of old are
+ * still in cache. The cache misses give a measured estimate of the memory traffic.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <precision.h>
+#include <functions.h>
+#include <counters.h>
+
+/** Events counted, in the order they are read */
+#define COUNTERS_EVENTS 3
+/** Bytes moved from memory by each cache miss */
+#define CACHE_LINE 64
+/** Doubles in each STREAM array, large enough to miss every cache */
+#define STREAM_SIZE (1 << 22)
+/** Times STREAM is repeated, the fastest is kept */
+#define STREAM_REPEATS 5
+
+/** Floating point operations per pixel in each phase */
+static const double phase_flops[COUNTERS_PHASES] = {
+    5.0,  /* 4 additions and a multiply */
+    2.0   /* a subtraction for the delta and an addition for the sum */
+};
+/** Bytes moved per pixel in each phase */
+static const double phase_bytes[COUNTERS_PHASES] = {
+    sizeof(real) + sizeof(edgenum) + 2*sizeof(real),  /* read old and edge, write allocate and store new */
+    3*sizeof(real)                                    /* read new and old, store old */
+};
+/** Names of the phases */
+static const char * phase_names[COUNTERS_PHASES] = {"stencil", "copy"};
+
+/** Whether phases are being measured */
+int counters_enabled = 0;
+
+/** The counters of one rank, as sent to rank 0 */
+typedef struct {
+    double time[COUNTERS_PHASES];                      /**< Seconds in each phase */
+    double pixels[COUNTERS_PHASES];                    /**< Pixels updated in each phase */
+    double events[COUNTERS_PHASES][COUNTERS_EVENTS];   /**< Events counted in each phase */
+    int have_events;                                   /**< Whether the events were counted */
+    double stream;                                     /**< STREAM triad bandwidth, in bytes/s */
+} counters_totals;
+
+/** The group leader, or -1 if counters are not available */
+static int leader = -1;
+/** The totals for this rank */
+static counters_totals totals;
+/** The time and events when the current phase started */
+static double mark_time;
+static double mark_events[COUNTERS_EVENTS];
+
+#ifdef __linux__
+/**
+ * @brief Open a hardware counter for this process
+ * @param config the event, see perf_event_open(2)
+ * @param group the group leader, or -1 to open a leader
+ * @return the counter, or -1 if it could not be opened
+ */
+static int counters_open (unsigned long long config, int group) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/**
+ * @brief Read the counters in to values, which are left alone if there are none
+ * @param values stores the count of each event
+ */
+static void counters_read (double * values) {
+    int e;
+    unsigned long long group[COUNTERS_EVENTS+1];
+
+    if (leader < 0) return;
+    if (read(leader, group, sizeof(group)) != sizeof(group)) return;
+    for (e = 0; e < COUNTERS_EVENTS; e++) values[e] = (double) group[e+1];
+}
+
+/**
+ * @brief Start measuring, with hardware counters if the kernel allows them
+ */
+void counters_init () {
+    memset(&totals, 0, sizeof(totals));
+    leader = -1;
+#ifdef __linux__
+    if ((leader = counters_open(PERF_COUNT_HW_CPU_CYCLES, -1)) >= 0) {
+        if (counters_open(PERF_COUNT_HW_INSTRUCTIONS, leader) < 0
+            || counters_open(PERF_COUNT_HW_CACHE_MISSES, leader) < 0) {
+            /* all or nothing, so the group reads the same events everywhere */
+            close(leader);
+            leader = -1;
+        } else {
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+#endif
+    totals.have_events = (leader >= 0);
+    counters_enabled = 1;
+}
+
+/**
+ * @brief Note the time and events at the start of a phase, see ::counters_start
+ */
+void counters_mark () {
+    counters_read(mark_events);
+    mark_time = get_time();
+}
+
+/**
+ * @brief Add the time and events since ::counters_mark to a phase, see ::counters_stop
+ * @param phase the phase
+ * @param pixels the number of pixels it updated
+ */
+void counters_add (counters_phase phase, int pixels) {
+    int e;
+    double now[COUNTERS_EVENTS];
+
+    totals.time[phase] += get_time() - mark_time;
+    totals.pixels[phase] += pixels;
+    if (leader >= 0) {
+        counters_read(now);
+        for (e = 0; e < COUNTERS_EVENTS; e++) totals.events[phase][e] += now[e] - mark_events[e];
+    }
+}
+
+/**
+ * @brief Measure the memory bandwidth with a STREAM triad, a = b + s*c
+ * @return the fastest bandwidth seen, in bytes/s
+ */
+static double counters_stream () {
+    int i, r;
+    double t, best = 0.0, s = 3.0;
+    double * a = (double *) malloc(STREAM_SIZE * sizeof(double));
+    double * b = (double *) malloc(STREAM_SIZE * sizeof(double));
+    double * c = (double *) malloc(STREAM_SIZE * sizeof(double));
+
+    for (i = 0; i < STREAM_SIZE; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    for (r = 0; r < STREAM_REPEATS; r++) {
+        t = get_time();
+        for (i = 0; i < STREAM_SIZE; i++) a[i] = b[i] + s*c[i];
+        t = get_time() - t;
+        if (t > 0.0 && 3.0*STREAM_SIZE*sizeof(double)/t > best) best = 3.0*STREAM_SIZE*sizeof(double)/t;
+    }
+
+    /* keep the triad from being optimised away */
+    if (a[STREAM_SIZE/2] != b[0] + s*c[0]) best = 0.0;
+
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+/**
+ * @brief Stop measuring, and print every rank's report on rank 0. Called by every process
+ * @param comm the communicator of the processes
+ * @param rank the rank of the calling process in comm
+ * @param size the number of processes in comm
+ */
+void counters_report (MPI_Comm comm, int rank, int size) {
+    int r, p, processes = size > 1 ? size : 1;
+    int * counts;
+    real ready = 0.0, all_ready;
+    double flops, bytes, gbs, intensity;
+    counters_totals * all, * t;
+
+    counters_enabled = 0;
+    if (leader >= 0) close(leader);
+
+    /* every rank runs STREAM at once, so each gets its share of the memory system */
+    reduce(comm, MPI_MAX, &ready, &all_ready);
+    totals.stream = counters_stream();
+
+    counts = (int *) malloc(processes * sizeof(int));
+    all = (counters_totals *) gather_bytes(comm, rank, size, &totals, sizeof(totals), counts);
+
+    if (rank == 0) {
+        printf("Performance counters: %s\n", all[0].have_events ? "perf_event_open" : "not available, timers only");
+        printf("Bytes and flops are modelled, over 100%% of STREAM means the tile stays in cache\n");
+        printf("%4s %-8s %9s %8s %8s %9s %8s %6s %10s\n",
+            "rank", "phase", "time (s)", "GFLOP/s", "GB/s", "flop/byte", "%STREAM", "IPC", "miss GB/s");
+        for (r = 0; r < processes; r++) {
+            t = &all[r];
+            for (p = 0; p < COUNTERS_PHASES; p++) {
+                if (t->time[p] <= 0.0) continue;
+                flops = phase_flops[p] * t->pixels[p];
+                bytes = phase_bytes[p] * t->pixels[p];
+                gbs = bytes / t->time[p] / 1.e9;
+                intensity = phase_flops[p] / phase_bytes[p];
+                printf("%4d %-8s %9.4f %8.3f %8.3f %9.3f %7.1f%%", r, phase_names[p], t->time[p],
+                    flops / t->time[p] / 1.e9, gbs, intensity, 100.0 * gbs * 1.e9 / t->stream);
+                if (t->have_events)
+                    printf(" %6.2f %10.3f", t->events[p][1] / t->events[p][0],
+                        CACHE_LINE * t->events[p][2] / t->time[p] / 1.e9);
+                printf("\n");
+            }
+            printf("%4d STREAM triad %.3f GB/s, so the stencil is bound at %.3f GFLOP/s\n", r, t->stream / 1.e9,
+                t->stream / 1.e9 * phase_flops[COUNTERS_STENCIL] / phase_bytes[COUNTERS_STENCIL]);
+        }
+        free(all);
+    }
+    free(counts);
+}
@@ -0,0 +1,192 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file grid.c
+ * @author James Clark
+ * @brief Arena allocator for 2D grids.
+ *
+ * Each grid is a single mapping holding a small header, the row pointers and the data.
+ * Rows start on a cache line and the stride is padded to whole cache lines, so a grid
+ * can be indexed as grid[i][j] or as &grid[0][0] + i*grid_stride(grid) + j.
+ * Fresh mappings are zeroed by the calling process, so their pages are placed on its
+ * NUMA node. Freed grids are kept in the arena and reused by later allocations.
+ * The arena is not thread safe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <grid.h>
+
+/** Rows are aligned and padded to a cache line */
+#define CACHE_LINE 64
+/** Strides that are a multiple of this alias in the cache, so get an extra line */
+#define ALIAS_STRIDE 4096
+/** Size of a normal page */
+#define PAGE 4096
+/** Size of a huge page */
+#define HUGE_PAGE (2*1024*1024)
+
+/** Rounds a up to a multiple of b */
+#define ROUND_UP(a,b) ((((a) + (b) - 1)/(b))*(b))
+
+/** Header at the start of every mapping */
+typedef struct grid_block {
+    size_t bytes;              /**< Size of the mapping */
+    int stride;                /**< Elements per row of the grid using the block */
+    struct grid_block * next;  /**< Next free block in the arena */
+} grid_block;
+
+/** Offset from the start of a mapping to the row pointers */
+#define ROWS_OFFSET ROUND_UP(sizeof(grid_block), CACHE_LINE)
+
+/** Blocks that have been freed and can be reused */
+static grid_block * arena = NULL;
+/** Page size used for new mappings */
+static grid_pages pages = GRID_PAGES_NORMAL;
+
+/**
+ * @brief Choose the page size for grids mapped from now on
+ * @param p the page size, see ::grid_pages
+ */
+void grid_set_pages (grid_pages p) {
+    pages = p;
+}
+
+/**
+ * @brief Map a new block and touch it, so it is placed on the caller's NUMA node
+ * @param bytes the minimum size of the block
+ * @return the new block, or NULL if it could not be mapped
+ */
+static grid_block * grid_map (size_t bytes) {
+    static int warned = 0;
+    void * base = MAP_FAILED;
+    size_t length = ROUND_UP(bytes, PAGE);
+
+#ifdef MAP_HUGETLB
+    if (pages == GRID_PAGES_EXPLICIT && bytes >= HUGE_PAGE) {
+        length = ROUND_UP(bytes, HUGE_PAGE);
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED) {
+            if (!warned) fprintf(stderr, "grid_map: no huge pages reserved, using transparent huge pages\n");
+            warned = 1;
+            length = ROUND_UP(bytes, PAGE);
+        }
+    }
+#endif
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        if (pages != GRID_PAGES_NORMAL && length >= HUGE_PAGE)
+            madvise(base, length, MADV_HUGEPAGE);
+#endif
+    }
+
+    /* first touch */
+    memset(base, 0, length);
+
+    ((grid_block *) base)->bytes = length;
+    return (grid_block *) base;
+}
+
+/**
+ * @brief Allocate an m x n grid
+ * @param size the size of each element
+ * @param m the number of rows
+ * @param n the number of elements in each row
+ * @return the row pointers of the grid, or NULL if it could not be allocated
+ */
+void * grid_alloc (size_t size, int m, int n) {
+    int i;
+    size_t stride, data_offset, bytes;
+    grid_block * block, ** prev;
+    char * base;
+    void ** rows;
+
+    /* pad rows to whole cache lines, avoiding strides that alias */
+    stride = ROUND_UP(n*size, CACHE_LINE);
+    if (stride % ALIAS_STRIDE == 0) stride += CACHE_LINE;
+    /* keep the stride a whole number of elements */
+    while (stride % size != 0) stride += CACHE_LINE;
+
+    data_offset = ROWS_OFFSET + ROUND_UP(m*sizeof(void *), CACHE_LINE);
+    bytes = data_offset + m*stride;
+
+    /* reuse a freed block if one fits without wasting more than half of it */
+    for (prev = &arena; *prev != NULL; prev = &((*prev)->next)) {
+        if ((*prev)->bytes >= bytes && (*prev)->bytes <= 2*bytes) break;
+    }
+    if (*prev != NULL) {
+        block = *prev;
+        *prev = block->next;
+    } else {
+        block = grid_map(bytes);
+        if (block == NULL) return NULL;
+    }
+
+    block->stride = stride/size;
+    block->next = NULL;
+
+    base = (char *) block;
+    rows = (void **) (base + ROWS_OFFSET);
+    for (i = 0; i < m; i++) {
+        rows[i] = base + data_offset + i*stride;
+    }
+    return rows;
+}
+
+/**
+ * @brief Get the number of elements between the starts of consecutive rows
+ * @param grid a grid from ::grid_alloc
+ * @return the row stride in elements
+ */
+int grid_stride (void * grid) {
+    return ((grid_block *) ((char *) grid - ROWS_OFFSET))->stride;
+}
+
+/**
+ * @brief Return a grid to the arena
+ * @param grid a grid from ::grid_alloc, or NULL
+ */
+void grid_free (void * grid) {
+    grid_block * block;
+
+    if (grid == NULL) return;
+
+    block = (grid_block *) ((char *) grid - ROWS_OFFSET);
+    block->next = arena;
+    arena = block;
+}
+
+/**
+ * @brief Unmap every block held in the arena
+ */
+void grid_release () {
+    grid_block * block;
+
+    while (arena != NULL) {
+        block = arena;
+        arena = block->next;
+        munmap(block, block->bytes);
+    }
+}
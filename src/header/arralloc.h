@@ -1,6 +0,0 @@
-#ifndef ARRALLOC_H
-#define ARRALLOC_H 1
-
-void *arralloc(size_t size, int ndim, ...);
-
-#endif
@@ -0,0 +1,61 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file counters.h
+ * @author James Clark
+ * @brief Defines the hardware counters, see counters.c.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H 1
+
+#include <mpi.h>
+
+/** The phases of ::update_tick that are measured */
+typedef enum {
+    COUNTERS_STENCIL = 0,  /**< Computing new from old */
+    COUNTERS_COPY = 1,     /**< Finding the delta and copying new to old */
+    COUNTERS_PHASES = 2
+} counters_phase;
+
+extern int counters_enabled;
+
+void counters_init ();
+void counters_mark ();
+void counters_add (counters_phase phase, int pixels);
+void counters_report (MPI_Comm comm, int rank, int size);
+
+/**
+ * @brief Start measuring a phase
+ */
+static inline void counters_start () {
+    if (counters_enabled) counters_mark();
+}
+
+/**
+ * @brief Stop measuring a phase started by ::counters_start
+ * @param phase the phase
+ * @param pixels the number of pixels it updated
+ */
+static inline void counters_stop (counters_phase phase, int pixels) {
+    if (counters_enabled) counters_add(phase, pixels);
+}
+
+#endif
@@ -26,10 +26,14 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H 1
 
+#include <repro.h>
+#include <reconstruct.h>
+
 /** Holds the delta and sum of pixels for the update function to return */
 typedef struct {
-    real delta;  /**< The maximum delta found */
-    real sum;    /**< The sum of all pixels */
+    real delta;       /**< The maximum delta found */
+    repro_sum sum;    /**< The sum of all pixels */
+    repro_sum square; /**< The sum of the squared deltas */
 } step_return;
 
 /** Holds the dimensions for the local and global image data */
@@ -38,15 +42,45 @@ typedef struct {
     int n;   /**< The global image size in dim 1 */
     int mp;  /**< The local  image size in dim 0 */
     int np;  /**< The local  image size in dim 1 */
+    const int * cuts[2]; /**< Where each process's tiles start in each dim, ending with m or n, or NULL if split evenly, see ::tile_extent */
 } image_dimensions;
 
+/** What the updates keep between calls, such as the persistent halo swap, one for each context */
+typedef struct update_state update_state;
+
+/** Holds the state of the active blocks, see active.c */
+typedef struct {
+    int size;         /**< The width and height of a block */
+    int bm;           /**< The number of blocks in dim 0 */
+    int bn;           /**< The number of blocks in dim 1 */
+    real threshold;   /**< Blocks changing by less than this are quiet */
+    real * delta;     /**< The maximum delta of each block when it was last updated */
+    repro_sum * sum;    /**< The sum of each block when it was last updated */
+    repro_sum * square; /**< The sum of squared deltas of each block when it was last updated */
+    int * quiet;      /**< The number of operations each block has been quiet for */
+    char * skip;      /**< Whether each block is skipped in the next operation */
+    real computed;    /**< The number of pixel updates performed */
+    real total;       /**< The number of pixel updates a full solve would have performed */
+} active_blocks;
+
 /** Holds the arguments for the program */
 typedef struct {
     char * filename;      /**< Input file name, required */
-    int iterations;       /**< Maximum iterations, provided by -i */
-    int step;             /**< Prints information every "step" steps, provided by -s */
-    double delta;         /**< Minimum delta value, provided by -d */
     char * output;        /**< Output file name, provided by -o */
+    int huge_pages;       /**< Page size for grids, see ::grid_pages, provided by -H */
+    int stream;           /**< Whether the input is a sequence of frames, provided by -S */
+    char * serve;         /**< Socket to serve jobs on, provided by --serve */
+    char * submit;        /**< Socket of the server to send the job to, provided by --submit */
+    int stop;             /**< Whether to stop the server, provided by --stop */
+    char * trace;         /**< File to write the event timeline to, provided by --trace */
+    int counters;         /**< Whether to report hardware counters, provided by --counters */
+    char * metrics;       /**< File to publish live metrics in, provided by --metrics */
+    int dims[2];          /**< Processes across and down the image, 0 to let MPI choose, provided by --grid */
+    char * autotune;      /**< Tuning cache file, provided by --autotune */
+    int tuned_given;      /**< Whether -t, --check_interval or --grid was given, which --autotune would replace */
+    char * out_of_core;   /**< Directory for the scratch files of an out-of-core run, provided by --out_of_core */
+    int batch;            /**< Frames of a stream to solve at once, 0 for one at a time, provided by --batch */
+    reconstruct_options options; /**< Options for each solve, provided by -i, -s, -d, -t, -a, --active_threshold, -w, --check_interval, --converge, --snapshot_every, --snapshot, --async, --poll_rows, --halo_float, --balance, --balance_threshold and --in_place */
 } args;
 
 void init (int argc, char * argv[], int * rank, int * size);
@@ -54,20 +88,82 @@ void finalise ();
 void m_abort ();
 
 double get_time();
+double clock_offset (MPI_Comm comm, int rank, int size);
 
-step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** edge, real ** old, real ** new);
+update_state * update_state_create ();
+void update_state_free (update_state * state);
+step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, update_state * state);
+step_return update_in_place (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, update_state * state);
+step_return update_active (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, active_blocks * active, update_state * state);
+void update_block (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, real ** save, int steps, step_return * results, update_state * state);
+void halo_release (update_state * state);
+void halo_poll (int rows);
+void halo_precision (int reduced);
+real halo_rounding ();
+void halo_timing (int * swaps, int * ready, double * wait);
+double halo_waited ();
+void async_start (MPI_Comm cart_comm, image_dimensions img_dim);
+step_return update_async (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new);
+void async_finish (real ** old);
 
 void image_size (char *filename, int *nx, int *ny);
-void image_read (int rank, char * filename, image_dimensions img_dim, real ** data);
-void image_write (int rank, char * filename, image_dimensions img_dim, real ** data);
+int image_check (char *filename, int *nx, int *ny);
+int image_read (int rank, char * filename, image_dimensions img_dim, edgenum ** data);
+int image_write (int rank, char * filename, image_dimensions img_dim, greynum ** data);
+
+void stream_size (char * filename, int * nx, int * ny);
+void stream_open (char * filename, image_dimensions img_dim);
+void stream_read (edgenum * frame);
+int stream_wait ();
+void stream_close ();
+
+void snapshot_open (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, int every, const char * pattern);
+void snapshot_tick (int iteration, real ** old);
+double snapshot_close (int * taken, int * skipped);
 
-void get_cart_comm (int * rank, int * size, int * dims, MPI_Comm * cart_comm);
-void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global);
-void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global);
+int ooc_solve (char * filename, char * output, char * dir, int m, int n, const reconstruct_options * options, reconstruct_result * result);
+
+int batch_solve (char * filename, char * output, int m, int n, int lanes, const reconstruct_options * options);
+
+void tune (MPI_Comm comm, int rank, int size, int m, int n, char * cache, reconstruct_options * options, int * dims);
+
+void serve (char * path, int rank, int size, reconstruct_options * options);
+int submit (char * path, char * edge, char * output, int iterations, double delta);
+
+int get_cart_comm (MPI_Comm comm, int * rank, int * size, int * dims, MPI_Comm * cart_comm);
+void free_cart_comm (MPI_Comm * cart_comm);
+void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, edgenum ** local, edgenum ** global);
+void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global);
+void gather_start (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global, MPI_Request * requests, int * count);
 void reduce (MPI_Comm cart_comm, MPI_Op op, real * delta, real * global_delta);
+void reduce_repro (MPI_Comm cart_comm, repro_sum * local, real * global);
+void reduce_start (MPI_Comm comm, MPI_Op op, real * local, real * global, int count, MPI_Request * request);
+int requests_test (int count, MPI_Request * requests, int wait);
+void broadcast (MPI_Comm comm, void * data, int bytes);
+void split_comm (MPI_Comm comm, int member, MPI_Comm * new_comm);
+void free_comm (MPI_Comm * comm);
+void dup_comm (MPI_Comm comm, MPI_Comm * new_comm);
+char * gather_bytes (MPI_Comm comm, int rank, int size, void * local, int bytes, int * counts);
+void migrate_tile (MPI_Comm cart_comm, int rank, int size, image_dimensions from, image_dimensions to, MPI_Datatype type, void * src, void * dst);
+
+int balance_cuts (const int * dims, int m, int n, int size, const int * coords, const real * speed, int * cuts);
+
+void active_init (active_blocks * active, image_dimensions img_dim, int size, real threshold);
+void active_sweep (active_blocks * active, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, int boundary);
+step_return active_finish (active_blocks * active, image_dimensions img_dim, real ** old, real ** new);
+void active_wake (active_blocks * active);
+void active_free (active_blocks * active);
 
 void setup_reconstruct (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** old);
+int warm_start (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, int levels, real delta, int iterations);
+void copy_tile (image_dimensions img_dim, real ** src, real ** dst);
+void quantise (MPI_Comm cart_comm, image_dimensions img_dim, real ** old, greynum ** grey);
+void tile_sum (image_dimensions img_dim, real ** old, repro_sum * sum);
+void grey_range (image_dimensions img_dim, real ** old, real * xmin, real * xmax);
+void grey_scale (image_dimensions img_dim, real ** old, real xmin, real xmax, greynum ** grey);
 void sawtooth (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** old);
+void boundary_sides (MPI_Comm cart_comm, int * low, int * high);
+void tile_extent (MPI_Comm cart_comm, int rank, image_dimensions img_dim, int * coords, int * offset, int * length);
 real boundaryval (int i, int m);
 
 #endif
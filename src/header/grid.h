@@ -0,0 +1,44 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file grid.h
+ * @author James Clark
+ * @brief Defines the 2D grid allocator.
+ */
+
+#ifndef GRID_H
+#define GRID_H 1
+
+#include <stddef.h>
+
+/** Page sizes the grid arena can map */
+typedef enum {
+    GRID_PAGES_NORMAL = 0,       /**< Ordinary pages */
+    GRID_PAGES_TRANSPARENT = 1,  /**< Ask for transparent huge pages */
+    GRID_PAGES_EXPLICIT = 2      /**< Use reserved huge pages, falling back to transparent ones */
+} grid_pages;
+
+void grid_set_pages (grid_pages pages);
+void * grid_alloc (size_t size, int m, int n);
+int grid_stride (void * grid);
+void grid_free (void * grid);
+void grid_release ();
+
+#endif
@@ -0,0 +1,103 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file metrics.h
+ * @author James Clark
+ * @brief Defines the live metrics file, see metrics.c and monitor/monitor.c.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H 1
+
+/** Identifies a metrics file */
+#define METRICS_MAGIC 0x4d455452
+/** Changed whenever ::metrics_data changes */
+#define METRICS_VERSION 1
+
+/** Where rank 0's time has gone, see metrics_data.seconds */
+typedef enum {
+    METRICS_COMPUTE = 0,  /**< Sweeping, less any waiting for halos */
+    METRICS_HALO = 1,     /**< Waiting for halos */
+    METRICS_REDUCE = 2,   /**< Reducing the delta, the norms and the average */
+    METRICS_OTHER = 3,    /**< Everything else: printing, snapshots and bookkeeping */
+    METRICS_PHASES = 4
+} metrics_phase;
+
+/** What the process publishing the metrics is doing */
+typedef enum {
+    METRICS_IDLE = 0,     /**< Between solves */
+    METRICS_SOLVING = 1,  /**< Solving */
+    METRICS_DONE = 2      /**< Finished, the process has closed the file */
+} metrics_state;
+
+/** The metrics, as laid out in the file */
+typedef struct {
+    unsigned int magic;              /**< METRICS_MAGIC */
+    unsigned int version;            /**< METRICS_VERSION */
+    unsigned int sequence;           /**< Odd while the metrics are being written, see ::metrics_read */
+    int state;                       /**< See ::metrics_state */
+    int pid;                         /**< The process publishing them */
+    int m;                           /**< The width of the image */
+    int n;                           /**< The height of the image */
+    int processes;                   /**< The processes solving it */
+    int solves;                      /**< Solves started, one per frame of a stream */
+    int stop;                        /**< The stop measure, see ::reconstruct_stop */
+    int iteration;                   /**< Iterations done */
+    int iterations;                  /**< The most iterations the solve will do */
+    int remaining;                   /**< Predicted iterations left to convergence, -1 if unknown */
+    double delta;                    /**< The last global delta */
+    double measure;                  /**< The last stop measure */
+    double target;                   /**< The stop measure to reach */
+    double rate;                     /**< The factor the measure shrinks by each iteration, 1 if unknown */
+    double speed;                    /**< Iterations per second */
+    double eta;                      /**< Predicted seconds left, to convergence or the iteration limit, -1 if unknown */
+    double elapsed;                  /**< Seconds since the solve started */
+    double seconds[METRICS_PHASES];  /**< Seconds of rank 0's time in each phase, see ::metrics_phase */
+    double updated;                  /**< Unix time of the last update */
+} metrics_data;
+
+extern int metrics_enabled;
+
+void metrics_open (char * path);
+void metrics_start (int m, int n, int processes, int stop, int iterations, double target);
+void metrics_publish (int iteration, double delta, double measure, double rate, int remaining, const double * seconds);
+void metrics_finish ();
+void metrics_close ();
+
+/**
+ * @brief Take a consistent copy of the metrics, while they may be being written
+ * @param shared the metrics in the file
+ * @param copy stores the copy
+ * @return 1 once a copy was taken, 0 if the file is not a metrics file
+ */
+static inline int metrics_read (const volatile metrics_data * shared, metrics_data * copy) {
+    unsigned int before, after;
+
+    if (shared->magic != METRICS_MAGIC || shared->version != METRICS_VERSION) return 0;
+    do {
+        before = __atomic_load_n(&(shared->sequence), __ATOMIC_ACQUIRE);
+        *copy = *(const metrics_data *) shared;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(shared->sequence), __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    return 1;
+}
+
+#endif
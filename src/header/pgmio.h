@@ -1,8 +1,23 @@
 #ifndef PGMIO_H
 #define PGMIO_H 1
 
+#include <stdio.h>
+
+#include <precision.h>
+
 void pgmsize (char *filename, int *nx, int *ny);
+int  pgmsizecheck (char *filename, int *nx, int *ny);
 void pgmread (char *filename, void *vx, int nx, int ny);
 void pgmwrite(char *filename, void *vx, int nx, int ny);
+void pgmreadedge (char *filename, edgenum **x, int nx, int ny);
+int  pgmreadedgecheck (char *filename, edgenum **x, int nx, int ny);
+int  pgmreadedgefp (FILE *fp, edgenum *x, int nx, int ny);
+void pgmwritegrey(char *filename, greynum **x, int nx, int ny);
+int  pgmwritegreycheck(char *filename, greynum **x, int nx, int ny);
+FILE *pgmreadedgestart(char *filename, int nx, int ny);
+void pgmreadedgerow(FILE *fp, edgenum *row, int nx);
+FILE *pgmwritegreystart(char *filename, int nx, int ny);
+void pgmwritegreyrow(FILE *fp, greynum *row, int nx, int *k);
+void pgmwritegreyend(FILE *fp, int k);
 
 #endif
@@ -30,4 +30,14 @@
 #define MPI_REALNUM MPI_DOUBLE
 /** pseudonym for a real number type. Can be set to either float or double */
 typedef double real;
+
+/** MPI type for ::edgenum */
+#define MPI_EDGENUM MPI_SHORT
+/** type the edge data is kept in. Edge files hold small integers, which it stores exactly */
+typedef short edgenum;
+
+/** MPI type for ::greynum */
+#define MPI_GREYNUM MPI_UNSIGNED_CHAR
+/** type of an output grey level, after scaling to 0..255 */
+typedef unsigned char greynum;
 #endif
@@ -0,0 +1,100 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file reconstruct.h
+ * @author James Clark
+ * @brief The libreconstruct API, see reconstruct.c.
+ */
+
+#ifndef RECONSTRUCT_H
+#define RECONSTRUCT_H 1
+
+#include <mpi.h>
+
+#include <precision.h>
+
+/** A reconstruction of one image size on one communicator, see ::reconstruct_create */
+typedef struct reconstruct_context reconstruct_context;
+
+/** What a solve compares with the delta option to decide it has converged */
+typedef enum {
+    RECONSTRUCT_STOP_DELTA,         /**< The largest change of any pixel in one iteration */
+    RECONSTRUCT_STOP_RESIDUAL_MAX,  /**< The largest residual of any pixel */
+    RECONSTRUCT_STOP_RESIDUAL_L2,   /**< The root mean square residual */
+    RECONSTRUCT_STOP_ERROR          /**< The root mean square error, estimated from the convergence rate */
+} reconstruct_stop;
+
+/** Holds the options for a solve, see ::reconstruct_default_options */
+typedef struct {
+    int iterations;          /**< Maximum iterations */
+    double delta;            /**< Stop once the stop measure is no more than this */
+    int step;                /**< Print progress on rank 0 every step iterations, 0 for none */
+    int tile_depth;          /**< Operations per wavefront block, 1 disables the wavefront */
+    int active_block;        /**< Size of the active blocks, 0 to update every pixel */
+    double active_threshold; /**< Blocks changing less than this can be skipped, negative for delta/100, which is also the largest used */
+    int warm_start;          /**< Number of coarse levels for the initial guess */
+    int keep_guess;          /**< 1 to start from the result of the previous solve, if there was one */
+    int check_interval;      /**< Check the global delta every check_interval iterations */
+    int stop;                /**< The stop measure, see ::reconstruct_stop */
+    int snapshot_every;      /**< Write the image every snapshot_every iterations, 0 for never */
+    const char * snapshot;   /**< printf pattern for the snapshot files, given the iteration */
+    int async;               /**< 1 to iterate without waiting for the neighbours' halos */
+    int poll_rows;           /**< Rows of the interior swept between tests of the halo swap, 0 to only wait */
+    int halo_float;          /**< 1 to swap halos as floats, confirming convergence with full precision */
+    int balance;             /**< Iterations between measurements of each process's speed, 0 to keep the partition */
+    double balance_threshold; /**< Repartition in proportion to the speeds once the slowest process is this fraction slower than the mean */
+    int in_place;            /**< 1 to update the image in place, keeping a few rows instead of a second grid */
+} reconstruct_options;
+
+/** Holds what a solve did, see ::reconstruct_solve */
+typedef struct {
+    int iterations;          /**< Iterations at full resolution */
+    int coarse_iterations;   /**< Iterations spent on the warm start */
+    double coarse_time;      /**< Seconds spent on the warm start, not included in time */
+    double delta;            /**< The last global delta */
+    double measure;          /**< The last value of the stop measure */
+    double rate;             /**< The estimated factor the error shrinks by each iteration, 1 if unknown */
+    int remaining;           /**< The predicted iterations left to converge, 0 if converged, -1 if unknown */
+    int snapshots;           /**< Snapshots written */
+    int snapshots_skipped;   /**< Snapshots dropped because the last one was still being written */
+    double snapshot_time;    /**< Seconds the slowest process spent on snapshots */
+    double average;          /**< The average pixel after the last iteration */
+    double time;             /**< Seconds spent iterating at full resolution */
+    double skipped;          /**< Fraction of pixel updates skipped by active blocks */
+    double halo_ready;       /**< Fraction of the halo swaps found complete by a test during the interior sweep, -1 if none */
+    double halo_wait;        /**< Mean seconds each process spent waiting for halo swaps */
+    int rebalances;          /**< Times the image was repartitioned, see reconstruct_options.balance */
+    double imbalance;        /**< How much slower than the mean the slowest process was when last measured, on rank 0 */
+} reconstruct_result;
+
+void reconstruct_default_options (reconstruct_options * options);
+
+reconstruct_context * reconstruct_create (MPI_Comm comm, int m, int n);
+reconstruct_context * reconstruct_create_grid (MPI_Comm comm, int m, int n, const int * dims);
+void reconstruct_destroy (reconstruct_context * context);
+void reconstruct_topology (reconstruct_context * context, int * rank, int * dims);
+
+void reconstruct_load (reconstruct_context * context, const edgenum * edge);
+int reconstruct_load_file (reconstruct_context * context, char * filename);
+int reconstruct_solve (reconstruct_context * context, const reconstruct_options * options, reconstruct_result * result);
+void reconstruct_fetch (reconstruct_context * context, greynum * grey);
+int reconstruct_save_file (reconstruct_context * context, char * filename);
+
+#endif
@@ -0,0 +1,83 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file repro.h
+ * @author James Clark
+ * @brief Defines the reproducible sums, see repro.c.
+ */
+
+#ifndef REPRO_H
+#define REPRO_H 1
+
+#include <stdint.h>
+
+#include <precision.h>
+
+/** The exponent of the split between the two parts of a ::repro_sum */
+#define REPRO_SPLIT (-16)
+/** The exponent of the lowest bit kept, bits of a value below 2^REPRO_LOW are dropped */
+#define REPRO_LOW (-78)
+
+/**
+ * A sum that does not depend on the order it was added up in. Each value is cut at
+ * 2^REPRO_SPLIT in to two fixed-point integers, the multiples of 2^REPRO_SPLIT and of
+ * 2^REPRO_LOW below it, and each part is added to a 128 bit integer, which is exact and
+ * associative. Values must be smaller than 2^(REPRO_SPLIT + 63), and the parts can take
+ * 2^64 values before they could overflow.
+ */
+typedef struct {
+    __int128 high;  /**< The sum of the multiples of 2^REPRO_SPLIT */
+    __int128 low;   /**< The sum of the multiples of 2^REPRO_LOW below 2^REPRO_SPLIT */
+} repro_sum;
+
+/** Which sums the update functions add up in their ::step_return, see ::repro_wanted */
+#define REPRO_SUM 1     /**< The sum of the pixels */
+#define REPRO_SQUARE 2  /**< The sum of the squared deltas */
+
+extern int repro_wanted;
+
+void repro_merge (repro_sum * sum, const repro_sum * other);
+void repro_add_squares (repro_sum * sum, const real * a, const real * b, int n);
+real repro_value (const repro_sum * sum);
+
+/**
+ * @brief Set a sum to zero
+ * @param sum the sum
+ */
+static inline void repro_zero (repro_sum * sum) {
+    sum->high = 0;
+    sum->low = 0;
+}
+
+/**
+ * @brief Add a value to a sum. Every step is exact, so the parts only depend on the value
+ * @param sum the sum
+ * @param x the value
+ */
+static inline void repro_add (repro_sum * sum, real x) {
+    /* scaled by 2^-REPRO_SPLIT, truncating towards zero, then the rest by 2^-REPRO_LOW */
+    int64_t high = (int64_t) (x * 0x1p16);
+
+    x -= (real) high * 0x1p-16;
+    sum->high += high;
+    sum->low += (int64_t) (x * 0x1p78);
+}
+
+#endif
@@ -0,0 +1,55 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trace.h
+ * @author James Clark
+ * @brief Defines the event timeline, see trace.c.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <mpi.h>
+
+extern int trace_enabled;
+
+double get_time();
+void trace_init (int events);
+void trace_record (const char * name, double start);
+void trace_write (MPI_Comm comm, int rank, int size, char * filename);
+
+/**
+ * @brief Start timing an event
+ * @return the start time, or 0 if tracing is off
+ */
+static inline double trace_begin () {
+    return trace_enabled ? get_time() : 0.0;
+}
+
+/**
+ * @brief Record an event started by ::trace_begin
+ * @param name the name of the event, which must be a string constant
+ * @param start the start time from ::trace_begin
+ */
+static inline void trace_end (const char * name, double start) {
+    if (trace_enabled) trace_record(name, start);
+}
+
+#endif
@@ -25,13 +25,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <mpi.h>
 #include <argp.h>
-#include <float.h>
 
-#include <arralloc.h>
+#include <grid.h>
 #include <precision.h>
+#include <reconstruct.h>
+#include <trace.h>
+#include <counters.h>
+#include <metrics.h>
 #include <functions.h>
 
 #include "argp/argp.c"
@@ -39,129 +43,253 @@
 /* Default options */
 /** Defualt output filename */
 #define OUTPUT "output.pgm"
-/** Default maximum number of iterations */
-#define MAX_COUNT 5000
-/** Default output interval */
-#define STEP 100
-/** Default minimum delta value */
-#define MIN_DELTA 0.1
+/** Default output filename pattern for a stream of frames */
+#define STREAM_OUTPUT "frame%04d.pgm"
+/** Events kept by each process for --trace */
+#define TRACE_EVENTS (1 << 20)
+/** Why ::reconstruct_solve can reject the options after argp has accepted them */
+#define SOLVE_REJECTED "The options cannot be combined, or --in_place was given tiles smaller than 4x4"
+
+/**
+ * @brief Print what a solve did
+ * @param rank the rank of the process calling the function
+ * @param options the options of the solve
+ * @param result what the solve did
+ */
+static void report (int rank, reconstruct_options * options, reconstruct_result * result) {
+    if (rank != 0) return;
+
+    if (result->coarse_iterations > 0)
+        printf("Warm start took %d coarse iterations in %lf, total time with the full resolution iterations: %lf\n",
+            result->coarse_iterations, result->coarse_time, result->coarse_time + result->time);
+    printf("Time for %d iterations: %lf\n", result->iterations, result->time);
+    printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", result->iterations, result->average, result->delta);
+    if (result->halo_ready >= 0.0)
+        printf("Halo swaps: %.1f%% complete when tested during the interior sweep, %.3f s waiting per process\n",
+            100.0*result->halo_ready, result->halo_wait);
+    if (options->balance > 0)
+        printf("Balance: repartitioned %d times, the slowest process was %.1f%% slower than the mean when last measured\n",
+            result->rebalances, 100.0*result->imbalance);
+    if (options->active_block > 0)
+        printf("Active blocks skipped %.1f%% of pixel updates\n", 100.0*result->skipped);
+    if (options->snapshot_every > 0)
+        printf("Snapshots: %d written, %d skipped while writing, %lf s spent on them (%.2f%% of the solve)\n",
+            result->snapshots, result->snapshots_skipped, result->snapshot_time, 100.0*result->snapshot_time/result->time);
+    if (options->stop != RECONSTRUCT_STOP_DELTA) {
+        printf("Stop measure %.16f, convergence rate %.8f per iteration\n", result->measure, result->rate);
+        if (result->remaining > 0)
+            printf("About %d more iterations would reach %g\n", result->remaining, options->delta);
+    }
+}
 
 int main (int argc, char * argv[]) {
-    int rank, size;
-    int iteration;
+    int rank, size, world_rank;
     /* Cartesian dimensions */
-    int dims[2] = {0,0};
-    /* Struct for global and local image dimensions */
-    image_dimensions img_dim;
-    /* For timing main loop */
+    int dims[2];
+    /* global image size */
+    int m, n;
+    /* For timing a stream of frames */
     double t0, t1;
-    /* Set inital global values. */
-    real global_delta = FLT_MAX,  // Using the max float means the first loop will always occur
-         global_average = 1.0;
-    /* Pointers for global and local storage */
-    real ** main_buf,
-         ** edge,
-         ** old,
-         ** new;
-    /* Initialise the return value for the update_step */
-    step_return return_val = {1.0, 1.0};
-
-    /* comminucator for cartesian space */
-    MPI_Comm cart_comm;
+    /* frames reconstructed, and whether another one is waiting */
+    int frame, total_iterations;
+    real found, more;
+    char output[FILENAME_MAX];
+    /* frames in the order of the file, only on rank 0. The next frame is read in to next_frame */
+    edgenum * this_frame = NULL,
+            * next_frame = NULL,
+            * swap_frame;
+    /* the reconstruction, and what each solve did */
+    reconstruct_context * context;
+    reconstruct_result result;
 
     args arguments;
 
     /* Set default arguments */
-    arguments.iterations = MAX_COUNT;
-    arguments.step = STEP;
-    arguments.delta = MIN_DELTA;
-    arguments.output = OUTPUT;
+    arguments.output = NULL;
+    arguments.huge_pages = GRID_PAGES_NORMAL;
+    arguments.stream = 0;
+    arguments.serve = NULL;
+    arguments.submit = NULL;
+    arguments.stop = 0;
+    arguments.trace = NULL;
+    arguments.counters = 0;
+    arguments.metrics = NULL;
+    arguments.dims[0] = 0;
+    arguments.dims[1] = 0;
+    arguments.autotune = NULL;
+    arguments.tuned_given = 0;
+    arguments.out_of_core = NULL;
+    arguments.batch = 0;
+    reconstruct_default_options(&(arguments.options));
 
     /* parse the command line options */
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
+    if (arguments.output == NULL)
+        arguments.output = arguments.stream ? STREAM_OUTPUT : OUTPUT;
+
+    /* a client only talks to the server, so needs no MPI */
+    if (arguments.submit != NULL)
+        return submit(arguments.submit, arguments.stop ? NULL : arguments.filename, arguments.output,
+            arguments.options.iterations, arguments.options.delta);
 
     /* initialise mpi (if parallel) and get rank and size */
     init(argc, argv, &rank, &size);
+    world_rank = rank;
 
-    /* Get the cartesian communicator */
-    get_cart_comm(&rank, &size, dims, &cart_comm);
+    if (arguments.trace != NULL) trace_init(TRACE_EVENTS);
+    if (arguments.counters) counters_init();
+    /* rank 0 has every global value the metrics need */
+    if (arguments.metrics != NULL && world_rank == 0) metrics_open(arguments.metrics);
 
-    /* confirm to stdout the number of processes and topology */
+    if (arguments.serve != NULL) {
+        grid_set_pages(arguments.huge_pages);
+        serve(arguments.serve, rank, size, &(arguments.options));
+        if (arguments.counters) counters_report(MPI_COMM_WORLD, world_rank, size);
+        if (arguments.trace != NULL) trace_write(MPI_COMM_WORLD, world_rank, size, arguments.trace);
+        grid_release();
+        metrics_close();
+        finalise();
+        return 0;
+    }
+
+    /* confirm to stdout the number of processes */
     if(rank == 0) {
         printf("Running on %d processes\n", size);
-        printf("Cartesian topology: %d x %d\n", dims[0], dims[1]);
     }
 
-    /* get the image dimensions */
-    image_size(arguments.filename, &(img_dim.m), &(img_dim.n));
+    /* get the image dimensions, of the first frame if streaming */
+    if (arguments.stream)
+        stream_size(arguments.filename, &m, &n);
+    else
+        image_size(arguments.filename, &m, &n);
 
-    /* check the image can be fit evenly on the processors */
-    if ((img_dim.m % dims[0] != 0) || (img_dim.n % dims[1] != 0)) {
-        if (rank == 0)
-            printf("Cannot fit %dx%d processes evenly on a %dx%d image\n",
-                dims[0], dims[1], img_dim.m, img_dim.n);
-        m_abort();
+    /* the image stays on disk, so the solve never allocates a grid */
+    if (arguments.out_of_core != NULL) {
+        if (size > 1) {
+            if (rank == 0) printf("Out of core runs on one process\n");
+            m_abort();
+        }
+        if (ooc_solve(arguments.filename, arguments.output, arguments.out_of_core, m, n, &(arguments.options), &result) != 0) {
+            printf("Out of core supports neither --active_block, --warm_start, --converge nor --snapshot_every\n");
+            m_abort();
+        }
+        report(rank, &(arguments.options), &result);
+        if (arguments.counters) counters_report(MPI_COMM_WORLD, world_rank, 1);
+        if (arguments.trace != NULL) trace_write(MPI_COMM_WORLD, world_rank, 1, arguments.trace);
+        metrics_close();
+        finalise();
+        return 0;
+    }
+
+    grid_set_pages(arguments.huge_pages);
+
+    /* the frames share one process's vector lanes, so there is nothing to split up */
+    if (arguments.batch > 0) {
+        if (size > 1) {
+            if (rank == 0) printf("Batches run on one process\n");
+            m_abort();
+        }
+        if (batch_solve(arguments.filename, arguments.output, m, n, arguments.batch, &(arguments.options)) != 0) {
+            printf("Batches support neither --tile_depth, --active_block, --warm_start, --converge, --snapshot_every nor --async\n");
+            m_abort();
+        }
+        if (arguments.counters) counters_report(MPI_COMM_WORLD, world_rank, 1);
+        if (arguments.trace != NULL) trace_write(MPI_COMM_WORLD, world_rank, 1, arguments.trace);
+        grid_release();
+        metrics_close();
+        finalise();
+        return 0;
     }
 
-    /* get local region dimensions */
-    img_dim.mp = img_dim.m/dims[0];
-    img_dim.np = img_dim.n/dims[1];
+    if (arguments.autotune != NULL)
+        tune(MPI_COMM_WORLD, rank, size, m, n, arguments.autotune, &(arguments.options), arguments.dims);
 
     /* Allocate memory */
-    if(rank == 0) {
-        /* Only rank 0 needs to allocate the main buffer */
-        printf("Allocating memory\n");
-        main_buf  = (real **) arralloc(sizeof(real), 2, img_dim.m,    img_dim.n);
+    if (rank == 0) printf("Allocating memory\n");
+    context = reconstruct_create_grid(MPI_COMM_WORLD, m, n, arguments.dims);
+
+    /* check the image can be fit evenly on the processors */
+    if (context == NULL) {
+        if (rank == 0 && arguments.dims[0] == 0 && arguments.dims[1] == 0)
+            printf("Cannot fit %d processes evenly on a %dx%d image\n", size, m, n);
+        else if (rank == 0)
+            printf("Cannot fit %d processes evenly as a %d x %d grid on a %dx%d image\n",
+                size, arguments.dims[0], arguments.dims[1], m, n);
+        m_abort();
     }
-    edge      = (real **) arralloc(sizeof(real), 2, img_dim.mp+2, img_dim.np+2);
-    old       = (real **) arralloc(sizeof(real), 2, img_dim.mp+2, img_dim.np+2);
-    new       = (real **) arralloc(sizeof(real), 2, img_dim.mp+2, img_dim.np+2);
 
-    image_read(rank, arguments.filename, img_dim, main_buf);
+    /* confirm to stdout the topology, rank is now the rank in the topology */
+    reconstruct_topology(context, &rank, dims);
+    if (rank == 0) {
+        printf("Cartesian topology: %d x %d\n", dims[0], dims[1]);
+    }
 
-    scatter_data(cart_comm, rank, size, img_dim, edge, main_buf);
+    if (!arguments.stream) {
+        if (reconstruct_load_file(context, arguments.filename) != 0) m_abort();
+        if (reconstruct_solve(context, &(arguments.options), &result) != 0) {
+            if (rank == 0) printf("%s\n", SOLVE_REJECTED);
+            m_abort();
+        }
+        report(rank, &(arguments.options), &result);
+        if (reconstruct_save_file(context, arguments.output) != 0) m_abort();
+    } else {
+        if (rank == 0) {
+            this_frame = (edgenum *) malloc(m*n * sizeof(edgenum));
+            next_frame = (edgenum *) malloc(m*n * sizeof(edgenum));
+            printf("Streaming %d x %d frames from file: %s\n", m, n, arguments.filename);
+            stream_open(arguments.filename, (image_dimensions) {m, n, m, n});
+            stream_read(this_frame);
+            stream_wait();
+            t0 = get_time();
+        }
+        total_iterations = 0;
 
-    setup_reconstruct(cart_comm, rank, img_dim, old);
+        /* each frame starts from the reconstruction of the one before */
+        arguments.options.keep_guess = 1;
+        for (frame = 0, more = 1.0; more > 0.0; frame++) {
+            reconstruct_load(context, this_frame);
 
-    if (rank == 0) t0 = get_time();
+            /* read the next frame while this one is reconstructed */
+            if (rank == 0) stream_read(next_frame);
 
-    /* Reconstruct the image */
-    iteration = 0;
-    while ((iteration < arguments.iterations) && (global_delta > arguments.delta)) {
-        return_val = update_tick(cart_comm, rank, img_dim, edge, old, new);
-        reduce(cart_comm, MPI_MAX, &(return_val.delta), &global_delta);
+            if (reconstruct_solve(context, &(arguments.options), &result) != 0) {
+                if (rank == 0) printf("%s\n", SOLVE_REJECTED);
+                m_abort();
+            }
+            report(rank, &(arguments.options), &result);
+            total_iterations += result.iterations;
 
-        if (iteration % arguments.step == 0) {
-            reduce(cart_comm, MPI_SUM, &(return_val.sum), &global_average);
+            snprintf(output, sizeof(output), arguments.output, frame);
+            if (reconstruct_save_file(context, output) != 0) m_abort();
+
+            found = 0.0;
             if (rank == 0) {
-                global_average /=  (img_dim.m * img_dim.n);
-                printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", iteration, global_average, global_delta);
+                printf("Frame %d took %d iterations\n", frame, result.iterations);
+                found = stream_wait();
+                swap_frame = this_frame;
+                this_frame = next_frame;
+                next_frame = swap_frame;
             }
+            /* only rank 0 knows if there is another frame */
+            reduce(MPI_COMM_WORLD, MPI_MAX, &found, &more);
         }
 
-        iteration++;
-    }
-    if (rank == 0) {
-        t1 = get_time();
-        printf("Time for %d iterations: %lf\n", iteration, t1-t0);
-    }
-    /* reduce global average, just in case the last step was not a stdout step */
-    reduce(cart_comm, MPI_SUM, &(return_val.sum), &global_average);
-    if (rank == 0) {
-        global_average /=  (img_dim.m * img_dim.n);
-        printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", iteration, global_average, global_delta);
+        if (rank == 0) {
+            t1 = get_time();
+            stream_close();
+            printf("Streamed %d frames in %lf s: %.2f frames/s, %.1f iterations per frame\n",
+                frame, t1-t0, frame/(t1-t0), (real) total_iterations/frame);
+            free(this_frame);
+            free(next_frame);
+        }
     }
 
-    gather_data(cart_comm, rank, size, img_dim, old, main_buf);
-
-    image_write(rank, arguments.output, img_dim, main_buf);
-
-
     /* clean up memory */
-    if (rank == 0) free(main_buf);
-    free(edge);
-    free(old);
-    free(new);
+    reconstruct_destroy(context);
+    if (arguments.counters) counters_report(MPI_COMM_WORLD, world_rank, size);
+    if (arguments.trace != NULL) trace_write(MPI_COMM_WORLD, world_rank, size, arguments.trace);
+    grid_release();
+    metrics_close();
 
     finalise();
 
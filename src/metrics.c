@@ -0,0 +1,211 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file metrics.c
+ * @author James Clark
+ * @brief Live metrics of the running solve, in a memory-mapped file.
+ *
+ * Rank 0 keeps a ::metrics_data in a file mapped shared, which a file in /dev/shm keeps
+ * in memory, and updates it every time the solve checks its stop measure. Nothing is
+ * reduced for the metrics: the global delta and measure are those the check reduced
+ * anyway, and the times are rank 0's own. Updating is a few stores in to the mapping, with
+ * no system calls, so it costs nothing noticeable however often the measure is checked.
+ * Readers such as reconstruct.monitor map the file too and use ::metrics_read, as the
+ * sequence number around each update tells them when a copy may be torn.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <metrics.h>
+
+double get_time();
+
+/** Whether this process publishes metrics */
+int metrics_enabled = 0;
+
+/** The mapped file */
+static metrics_data * shared = NULL;
+/** When the current solve started, by ::get_time */
+static double started;
+
+/**
+ * @brief Get the time of day, which readers compare with metrics_data.updated
+ * @return seconds since the epoch
+ */
+static double metrics_now () {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec + 1.e-9 * now.tv_nsec;
+}
+
+/**
+ * @brief Mark the metrics as being written, see ::metrics_read
+ */
+static void metrics_begin () {
+    __atomic_store_n(&(shared->sequence), shared->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Mark the metrics as written, see ::metrics_begin
+ */
+static void metrics_end () {
+    shared->updated = metrics_now();
+    __atomic_store_n(&(shared->sequence), shared->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Start publishing metrics. Only the process that calls this publishes them,
+ *        which should be rank 0. If the file cannot be made the run carries on without.
+ * @param path the metrics file, ideally in /dev/shm
+ */
+void metrics_open (char * path) {
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 || ftruncate(fd, sizeof(metrics_data)) != 0) {
+        fprintf(stderr, "metrics_open: cannot create <%s>, no metrics will be published\n", path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    shared = (metrics_data *) mmap(NULL, sizeof(metrics_data), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    /* the mapping keeps the file */
+    close(fd);
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "metrics_open: cannot map <%s>, no metrics will be published\n", path);
+        shared = NULL;
+        return;
+    }
+
+    memset(shared, 0, sizeof(metrics_data));
+    shared->version = METRICS_VERSION;
+    shared->pid = getpid();
+    shared->state = METRICS_IDLE;
+    shared->remaining = -1;
+    shared->eta = -1.0;
+    shared->updated = metrics_now();
+    /* last, so a reader never takes a half made file for a metrics file */
+    __atomic_store_n(&(shared->magic), METRICS_MAGIC, __ATOMIC_RELEASE);
+    metrics_enabled = 1;
+}
+
+/**
+ * @brief Publish the start of a solve
+ * @param m the width of the image
+ * @param n the height of the image
+ * @param processes the processes solving it
+ * @param stop the stop measure, see ::reconstruct_stop
+ * @param iterations the most iterations the solve will do
+ * @param target the stop measure to reach
+ */
+void metrics_start (int m, int n, int processes, int stop, int iterations, double target) {
+    int p;
+
+    if (!metrics_enabled) return;
+    started = get_time();
+
+    metrics_begin();
+    shared->state = METRICS_SOLVING;
+    shared->m = m;
+    shared->n = n;
+    shared->processes = processes;
+    shared->solves++;
+    shared->stop = stop;
+    shared->iteration = 0;
+    shared->iterations = iterations;
+    shared->remaining = -1;
+    shared->delta = 0.0;
+    shared->measure = 0.0;
+    shared->target = target;
+    shared->rate = 1.0;
+    shared->speed = 0.0;
+    shared->eta = -1.0;
+    shared->elapsed = 0.0;
+    for (p = 0; p < METRICS_PHASES; p++) shared->seconds[p] = 0.0;
+    metrics_end();
+}
+
+/**
+ * @brief Publish the progress of the solve
+ * @param iteration the iterations done
+ * @param delta the last global delta
+ * @param measure the last stop measure
+ * @param rate the factor the measure shrinks by each iteration, 1 if unknown
+ * @param remaining the predicted iterations left, -1 if unknown
+ * @param seconds the seconds spent computing, waiting for halos and reducing. The rest of
+ *        the time since ::metrics_start is put down to METRICS_OTHER
+ */
+void metrics_publish (int iteration, double delta, double measure, double rate, int remaining, const double * seconds) {
+    double elapsed;
+    int p, left;
+
+    if (!metrics_enabled) return;
+    elapsed = get_time() - started;
+
+    metrics_begin();
+    shared->iteration = iteration;
+    shared->delta = delta;
+    shared->measure = measure;
+    shared->rate = rate;
+    shared->remaining = remaining;
+    shared->elapsed = elapsed;
+    shared->speed = elapsed > 0.0 ? iteration / elapsed : 0.0;
+    /* the solve stops at its iteration limit even if not converged */
+    left = shared->iterations - iteration;
+    if (remaining >= 0 && remaining < left) left = remaining;
+    shared->eta = shared->speed > 0.0 ? left / shared->speed : -1.0;
+    shared->seconds[METRICS_OTHER] = elapsed;
+    for (p = 0; p < METRICS_OTHER; p++) {
+        shared->seconds[p] = seconds[p];
+        shared->seconds[METRICS_OTHER] -= seconds[p];
+    }
+    if (shared->seconds[METRICS_OTHER] < 0.0) shared->seconds[METRICS_OTHER] = 0.0;
+    metrics_end();
+}
+
+/**
+ * @brief Publish the end of a solve
+ */
+void metrics_finish () {
+    if (!metrics_enabled) return;
+
+    metrics_begin();
+    shared->state = METRICS_IDLE;
+    metrics_end();
+}
+
+/**
+ * @brief Stop publishing metrics. The file is left, marked done, for readers to see
+ */
+void metrics_close () {
+    if (!metrics_enabled) return;
+
+    metrics_begin();
+    shared->state = METRICS_DONE;
+    metrics_end();
+    munmap(shared, sizeof(metrics_data));
+    shared = NULL;
+    metrics_enabled = 0;
+}
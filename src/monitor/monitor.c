@@ -0,0 +1,195 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file monitor/monitor.c
+ * @author James Clark
+ * @brief Shows the live metrics of a run started with --metrics, see metrics.c.
+ *
+ * The metrics file is mapped read only, so watching a run never slows it down. A line
+ * is printed each interval the metrics have changed, until the run closes the file or
+ * its process is gone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <float.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <argp.h>
+
+#include <metrics.h>
+
+/** Default seconds between lines */
+#define INTERVAL 1.0
+
+/** Holds the arguments for the monitor */
+typedef struct {
+    char * filename;  /**< The metrics file */
+    double interval;  /**< Seconds between lines */
+    int once;         /**< Whether to print one line and exit */
+} monitor_args;
+
+/**
+ * @brief Sleep for a while
+ * @param seconds how long
+ */
+static void monitor_sleep (double seconds) {
+    struct timespec wait;
+
+    wait.tv_sec = (time_t) seconds;
+    wait.tv_nsec = (long) (1.e9 * (seconds - wait.tv_sec));
+    nanosleep(&wait, NULL);
+}
+
+/**
+ * @brief Map the metrics file, waiting for the run to make it
+ * @param filename the metrics file
+ * @param interval seconds between attempts
+ * @return the mapped metrics
+ */
+static const volatile metrics_data * monitor_open (char * filename, double interval) {
+    struct stat info;
+    void * shared;
+    int fd, waiting = 0;
+
+    while (1) {
+        if ((fd = open(filename, O_RDONLY)) >= 0) {
+            if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(metrics_data)) break;
+            close(fd);
+        }
+        if (!waiting) fprintf(stderr, "Waiting for <%s>\n", filename);
+        waiting = 1;
+        monitor_sleep(interval);
+    }
+
+    shared = mmap(NULL, sizeof(metrics_data), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "monitor: cannot map <%s>\n", filename);
+        exit(1);
+    }
+    return (const volatile metrics_data *) shared;
+}
+
+/**
+ * @brief Print one line of the metrics
+ * @param metrics the metrics
+ */
+static void monitor_print (const metrics_data * metrics) {
+    static const char * measures[] = {"delta", "max", "l2", "error"};
+    double total;
+    int p;
+
+    if (metrics->state == METRICS_DONE) {
+        printf("Finished after %d solves\n", metrics->solves);
+        return;
+    }
+    if (metrics->state == METRICS_IDLE) {
+        printf("Idle after %d solves\n", metrics->solves);
+        return;
+    }
+
+    printf("Solve %d, %dx%d on %d: iteration %d/%d", metrics->solves, metrics->m, metrics->n,
+        metrics->processes, metrics->iteration, metrics->iterations);
+    /* the delta is not reduced on every check when stopping on a residual norm */
+    if (metrics->delta < FLT_MAX) printf("  delta %.3e", metrics->delta);
+    if (metrics->stop != 0 && metrics->stop < 4 && metrics->measure < FLT_MAX)
+        printf("  %s %.3e", measures[metrics->stop], metrics->measure);
+    printf(" (target %.1e)  %.1f it/s", metrics->target, metrics->speed);
+    if (metrics->eta >= 0.0) printf("  ETA %.1f s", metrics->eta);
+    else printf("  ETA -");
+
+    total = 0.0;
+    for (p = 0; p < METRICS_PHASES; p++) total += metrics->seconds[p];
+    if (total > 0.0)
+        printf("  compute %.0f%% halo %.0f%% reduce %.0f%% other %.0f%%",
+            100.0 * metrics->seconds[METRICS_COMPUTE] / total, 100.0 * metrics->seconds[METRICS_HALO] / total,
+            100.0 * metrics->seconds[METRICS_REDUCE] / total, 100.0 * metrics->seconds[METRICS_OTHER] / total);
+    printf("\n");
+}
+
+static error_t parse_opt (int key, char * arg, struct argp_state * state) {
+    monitor_args * arguments = state->input;
+
+    switch (key) {
+        case 'n':
+            arguments->interval = atof(arg);
+            if (arguments->interval <= 0.0) argp_error(state, "SECONDS must be positive");
+            break;
+        case '1':
+            arguments->once = 1;
+            break;
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1) argp_usage(state);
+            arguments->filename = arg;
+            break;
+        case ARGP_KEY_END:
+            if (state->arg_num < 1) argp_usage(state);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp_option options[] = {
+    {"interval", 'n', "SECONDS", 0, "Print a line every SECONDS, default 1"},
+    {"once", '1', 0, 0, "Print one line and exit"},
+    {0}
+};
+
+static struct argp argp = {options, parse_opt, "metrics_file", "show the progress of a reconstruct run started with --metrics"};
+
+int main (int argc, char * argv[]) {
+    monitor_args arguments = {NULL, INTERVAL, 0};
+    const volatile metrics_data * shared;
+    metrics_data metrics;
+    unsigned int last = 0;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+    shared = monitor_open(arguments.filename, arguments.interval);
+
+    /* the run may not have finished making the file */
+    while (!metrics_read(shared, &metrics)) monitor_sleep(arguments.interval);
+
+    while (1) {
+        metrics_read(shared, &metrics);
+        if (metrics.sequence != last || arguments.once) {
+            monitor_print(&metrics);
+            fflush(stdout);
+            last = metrics.sequence;
+        }
+        if (arguments.once || metrics.state == METRICS_DONE) break;
+        /* a run that was killed never marks the file done */
+        if (kill(metrics.pid, 0) != 0 && errno == ESRCH) {
+            printf("Process %d has gone\n", metrics.pid);
+            break;
+        }
+        monitor_sleep(arguments.interval);
+    }
+
+    munmap((void *) shared, sizeof(metrics_data));
+    return 0;
+}
@@ -0,0 +1,409 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file ooc.c
+ * @author James Clark
+ * @brief Out-of-core reconstruction of images larger than memory, on one process.
+ *
+ * The edge data and two copies of the image live in memory-mapped scratch files, stored
+ * a row of the PGM file at a time from the top, with the sawtooth as halo rows above and
+ * below and the periodic wrap as halo columns. Each pass streams the rows of one image
+ * through a few rows of memory per iteration and writes the other image, advancing
+ * several iterations at once: row r of iteration s is computed as soon as row r+1 of
+ * iteration s-1 is, so the files are read and written once per pass rather than once per
+ * iteration. Read-ahead is requested a band ahead of the sweep and write-back started a
+ * band behind it, so the disk works while the rows in between are computed, and bands
+ * the sweep has passed are dropped from the mappings.
+ *
+ * Every pixel is computed with the same operands in the same order as ::update_tick, so
+ * the result is identical to an in-core run. A pass that converges part way through is
+ * run again from its unchanged input, up to the converged iteration.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <mpi.h>
+
+#include <pgmio.h>
+#include <trace.h>
+#include <precision.h>
+#include <functions.h>
+
+/** Bytes of each file requested ahead of, or dropped behind, the sweep at a time */
+#define OOC_BAND (16*1024*1024)
+
+/** A memory-mapped scratch file */
+typedef struct {
+    char path[FILENAME_MAX];  /**< The file */
+    int fd;                   /**< The open file */
+    size_t bytes;             /**< The size of the file and mapping */
+    char * data;              /**< The mapping */
+} ooc_file;
+
+/** The state of an out-of-core reconstruction */
+typedef struct {
+    int m;                  /**< The width of the image */
+    int n;                  /**< The height of the image */
+    int width;              /**< Reals per image row, including the halo columns */
+    int band;               /**< Rows per band */
+    ooc_file edge;          /**< The edge data, m per row */
+    ooc_file image[2];      /**< The images, n+2 rows of width */
+    real * rings;           /**< The last 3 rows of each iteration of a pass */
+    size_t streamed;        /**< Bytes read and written by the passes */
+} ooc_state;
+
+/**
+ * @brief Create and map a scratch file
+ * @param file stores the file
+ * @param dir the directory to create it in
+ * @param name the name of the file
+ * @param bytes the size of the file
+ */
+static void ooc_map (ooc_file * file, char * dir, char * name, size_t bytes) {
+    snprintf(file->path, sizeof(file->path), "%s/%s", dir, name);
+    file->bytes = bytes;
+
+    if ((file->fd = open(file->path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0
+        || ftruncate(file->fd, bytes) != 0) {
+        fprintf(stderr, "ooc_map: cannot create <%s>\n", file->path);
+        exit(-1);
+    }
+    file->data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (file->data == MAP_FAILED) {
+        fprintf(stderr, "ooc_map: cannot map <%s>\n", file->path);
+        exit(-1);
+    }
+    madvise(file->data, bytes, MADV_SEQUENTIAL);
+}
+
+/**
+ * @brief Unmap and delete a scratch file
+ * @param file the file
+ */
+static void ooc_unmap (ooc_file * file) {
+    munmap(file->data, file->bytes);
+    close(file->fd);
+    unlink(file->path);
+}
+
+/**
+ * @brief Find the page aligned span of some rows of a file
+ * @param file the file
+ * @param row_bytes the size of a row
+ * @param first the first row
+ * @param last one past the last row
+ * @param start stores the offset of the span
+ * @return the length of the span, 0 if there are no rows
+ */
+static size_t ooc_span (ooc_file * file, size_t row_bytes, long first, long last, size_t * start) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end;
+
+    if (first < 0) first = 0;
+    end = last * row_bytes;
+    if (last < 0 || end > file->bytes) end = last < 0 ? 0 : file->bytes;
+    *start = ((first * row_bytes) / page) * page;
+    return end > *start ? end - *start : 0;
+}
+
+/**
+ * @brief Start reading some rows of a file in the background
+ * @param file the file
+ * @param row_bytes the size of a row
+ * @param first the first row
+ * @param last one past the last row
+ */
+static void ooc_ahead (ooc_file * file, size_t row_bytes, long first, long last) {
+    size_t start, length = ooc_span(file, row_bytes, first, last, &start);
+
+    if (length > 0) madvise(file->data + start, length, MADV_WILLNEED);
+}
+
+/**
+ * @brief Drop some rows of a file from the mapping, starting to write them back first if
+ *        they were changed. The page cache keeps them until they are written.
+ * @param file the file
+ * @param row_bytes the size of a row
+ * @param first the first row
+ * @param last one past the last row
+ * @param written 1 if the rows were changed
+ */
+static void ooc_behind (ooc_file * file, size_t row_bytes, long first, long last, int written) {
+    size_t start, length = ooc_span(file, row_bytes, first, last, &start);
+
+    if (length == 0) return;
+    if (written) sync_file_range(file->fd, start, length, SYNC_FILE_RANGE_WRITE);
+    madvise(file->data + start, length, MADV_DONTNEED);
+}
+
+/**
+ * @brief Advance an image several iterations in one pass over the files
+ * @param state the reconstruction
+ * @param src the image to start from, which is not changed
+ * @param dst stores the image after the pass
+ * @param steps the number of iterations
+ * @param results stores the ::step_return of each iteration
+ */
+static void ooc_pass (ooc_state * state, int src, int dst, int steps, step_return * results) {
+    int w, r, s, c, m = state->m, n = state->n, width = state->width, band = state->band;
+    size_t row_bytes = width * sizeof(real), edge_bytes = m * sizeof(edgenum);
+    real * in = (real *) state->image[src].data;
+    real * out = (real *) state->image[dst].data;
+    edgenum * edge = (edgenum *) state->edge.data;
+    real * prev, * next, * up, * down;
+    edgenum * e;
+    real delta;
+    double t = trace_begin();
+
+/* row r of iteration s of the pass, iteration 0 being the input */
+#define RING(s, r) (state->rings + ((s)*3 + (r)%3) * width)
+
+    for (s = 0; s < steps; s++) {
+        results[s].delta = 0.0;
+        repro_zero(&(results[s].sum));
+        repro_zero(&(results[s].square));
+    }
+    ooc_ahead(&(state->image[src]), row_bytes, 0, band);
+    ooc_ahead(&(state->edge), edge_bytes, 0, band);
+
+    /* iteration s trails iteration s-1 by one row */
+    for (w = 0; w < n+2+steps; w++) {
+        if (w % band == 0) {
+            ooc_ahead(&(state->image[src]), row_bytes, w+band, w+2*band);
+            ooc_ahead(&(state->edge), edge_bytes, w+band-1, w+2*band-1);
+            ooc_behind(&(state->image[src]), row_bytes, w-2*band, w-band, 0);
+            ooc_behind(&(state->edge), edge_bytes, w-steps-2*band, w-steps-band, 0);
+            ooc_behind(&(state->image[dst]), row_bytes, w-steps-2*band, w-steps-band, 1);
+        }
+
+        if (w < n+2) memcpy(RING(0, w), in + (size_t) w*width, row_bytes);
+
+        for (s = 1; s < steps+1; s++) {
+            r = w - s;
+            if (r < 0 || r > n+1) continue;
+            next = RING(s, r);
+            prev = RING(s-1, r);
+
+            if (r == 0 || r == n+1) {
+                /* the sawtooth rows never change */
+                memcpy(next, prev, row_bytes);
+            } else {
+                up   = RING(s-1, r-1);
+                down = RING(s-1, r+1);
+                e = edge + (size_t) (r-1)*m;
+                /* the same operands in the same order as update_tick, below before above */
+                for (c = 1; c < m+1; c++) {
+                    next[c] = 0.25 * (prev[c-1] + prev[c+1] + down[c] + up[c] - e[c-1]);
+                }
+                next[0] = next[m];
+                next[m+1] = next[1];
+
+                for (c = 1; c < m+1; c++) {
+                    delta = fabs(next[c] - prev[c]);
+                    if (delta > results[s-1].delta) {
+                        results[s-1].delta = delta;
+                    }
+                    /* the disk is far slower than the sum, so it is always added up */
+                    repro_add(&(results[s-1].sum), next[c]);
+                }
+            }
+
+            if (s == steps) memcpy(out + (size_t) r*width, next, row_bytes);
+        }
+    }
+#undef RING
+
+    ooc_behind(&(state->image[dst]), row_bytes, 0, n+2, 1);
+    ooc_behind(&(state->image[src]), row_bytes, 0, n+2, 0);
+    ooc_behind(&(state->edge), edge_bytes, 0, n, 0);
+    state->streamed += 2 * state->image[0].bytes + state->edge.bytes;
+    trace_end("out of core pass", t);
+}
+
+/**
+ * @brief Read the edge data in to its scratch file, and set up the initial image
+ * @param state the reconstruction
+ * @param filename the edge file
+ */
+static void ooc_load (ooc_state * state, char * filename) {
+    int r, c, m = state->m, n = state->n, width = state->width;
+    size_t edge_bytes = m * sizeof(edgenum), row_bytes = width * sizeof(real);
+    edgenum * edge = (edgenum *) state->edge.data;
+    real * image = (real *) state->image[0].data;
+    real val;
+    FILE * fp = pgmreadedgestart(filename, m, n);
+
+    printf("Reading %d x %d picture from file: %s\n", m, n, filename);
+    for (r = 0; r < n; r++) {
+        pgmreadedgerow(fp, edge + (size_t) r*m, m);
+        if (r % state->band == 0) ooc_behind(&(state->edge), edge_bytes, r-2*state->band, r-state->band, 1);
+    }
+    fclose(fp);
+
+    /* white, with the sawtooth above and below, as setup_reconstruct does */
+    for (r = 0; r < n+2; r++) {
+        for (c = 0; c < width; c++) {
+            image[(size_t) r*width + c] = 255.0;
+        }
+        if (r % state->band == 0) ooc_behind(&(state->image[0]), row_bytes, r-2*state->band, r-state->band, 1);
+    }
+    for (c = 1; c < m+1; c++) {
+        val = boundaryval(c, m);
+        image[c] = 255.0*(1.0-val);
+        image[(size_t) (n+1)*width + c] = 255.0*val;
+    }
+}
+
+/**
+ * @brief Scale an image to grey levels and write it a row at a time
+ * @param state the reconstruction
+ * @param current the image to write
+ * @param filename the file to write
+ */
+static void ooc_save (ooc_state * state, int current, char * filename) {
+    int r, k = 0, m = state->m, n = state->n;
+    real * image = (real *) state->image[current].data;
+    real xmin, xmax, row_min, row_max;
+    image_dimensions row_dim = {m, n, 1, m};
+    /* each row as a one row grid, see ::grey_range */
+    real * rows[2];
+    greynum * grey = (greynum *) malloc((m+2) * sizeof(greynum));
+    greynum * grows[2] = {NULL, grey};
+    FILE * fp;
+
+    for (r = 1; r < n+1; r++) {
+        rows[1] = image + (size_t) r*state->width;
+        grey_range(row_dim, rows, &row_min, &row_max);
+        if (r == 1 || row_min < xmin) xmin = row_min;
+        if (r == 1 || row_max > xmax) xmax = row_max;
+    }
+
+    fp = pgmwritegreystart(filename, m, n);
+    for (r = 1; r < n+1; r++) {
+        rows[1] = image + (size_t) r*state->width;
+        grey_scale(row_dim, rows, xmin, xmax, grows);
+        pgmwritegreyrow(fp, grey+1, m, &k);
+    }
+    pgmwritegreyend(fp, k);
+    free(grey);
+}
+
+/**
+ * @brief Reconstruct an image out of core, on one process
+ * @param filename the edge file
+ * @param output the file to write the result to
+ * @param dir the directory for the scratch files
+ * @param m the width of the image
+ * @param n the height of the image
+ * @param options the options, see ::reconstruct_default_options. tile_depth is the
+ *        number of iterations per pass
+ * @param result stores what the solve did
+ * @return 0 on success, or -1 if the options are not supported out of core
+ */
+int ooc_solve (char * filename, char * output, char * dir, int m, int n, const reconstruct_options * options, reconstruct_result * result) {
+    ooc_state state;
+    int s, steps, iteration, current, passes = 0;
+    real global_delta = FLT_MAX;
+    step_return return_val = {1.0};
+    step_return * results;
+    double t0;
+
+    if (options->tile_depth < 1 || options->active_block > 0 || options->warm_start > 0
+        || options->stop != RECONSTRUCT_STOP_DELTA || options->snapshot_every > 0)
+        return -1;
+
+    state.m = m;
+    state.n = n;
+    state.width = m+2;
+    state.band = OOC_BAND / (state.width * sizeof(real));
+    if (state.band < 1) state.band = 1;
+    state.streamed = 0;
+    ooc_map(&(state.edge), dir, "reconstruct-edge.bin", (size_t) m*n * sizeof(edgenum));
+    ooc_map(&(state.image[0]), dir, "reconstruct-image0.bin", (size_t) (n+2)*state.width * sizeof(real));
+    ooc_map(&(state.image[1]), dir, "reconstruct-image1.bin", (size_t) (n+2)*state.width * sizeof(real));
+    state.rings = (real *) malloc((size_t) (options->tile_depth+1) * 3 * state.width * sizeof(real));
+    results = (step_return *) malloc(options->tile_depth * sizeof(step_return));
+
+    ooc_load(&state, filename);
+    printf("Out of core: %d iterations per pass, %.1f MB of rows in memory, %d row bands\n",
+        options->tile_depth, (options->tile_depth+1) * 3.0 * state.width * sizeof(real) / 1.e6, state.band);
+
+    t0 = get_time();
+    current = 0;
+    iteration = 0;
+    while ((iteration < options->iterations) && (global_delta > options->delta)) {
+        steps = options->tile_depth;
+        if (steps > options->iterations - iteration) steps = options->iterations - iteration;
+
+        ooc_pass(&state, current, 1-current, steps, results);
+        passes++;
+
+        for (s = 0; (s < steps) && (global_delta > options->delta); s++) {
+            return_val = results[s];
+            global_delta = return_val.delta;
+
+            if (options->step > 0 && iteration % options->step == 0)
+                printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", iteration, repro_value(&(return_val.sum)) / ((real) m*n), global_delta);
+
+            iteration++;
+        }
+
+        /* converged part way through the pass, so run it again up to the converged iteration */
+        if (s < steps) {
+            ooc_pass(&state, current, 1-current, s, results);
+            passes++;
+        }
+        current = 1-current;
+    }
+
+    result->time = get_time() - t0;
+    result->iterations = iteration;
+    result->coarse_iterations = 0;
+    result->coarse_time = 0.0;
+    result->delta = global_delta;
+    result->average = repro_value(&(return_val.sum)) / ((real) m*n);
+    result->skipped = 0.0;
+    result->halo_ready = -1.0;
+    result->halo_wait = 0.0;
+    result->measure = global_delta;
+    result->rate = 1.0;
+    result->remaining = -1;
+    result->snapshots = 0;
+    result->snapshots_skipped = 0;
+    result->snapshot_time = 0.0;
+    printf("Out of core: %d passes, %.1f MB streamed per iteration\n",
+        passes, iteration > 0 ? state.streamed / 1.e6 / iteration : 0.0);
+
+    ooc_save(&state, current, output);
+
+    free(results);
+    free(state.rings);
+    ooc_unmap(&(state.edge));
+    ooc_unmap(&(state.image[0]));
+    ooc_unmap(&(state.image[1]));
+    return 0;
+}
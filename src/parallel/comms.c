@@ -24,27 +24,49 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <math.h>
 
+#include <grid.h>
+#include <trace.h>
 #include <precision.h>
 #include <functions.h>
 
 /**
  * @brief Create the cartesian communicator and dimensions for the topology.
- * @param rank the rank of the process calling the function
- * @param size the number of processes in the communicator
- * @param dims stores how many processes are in each dimension
+ * @param comm the communicator of the processes to use
+ * @param rank stores the rank of the process calling the function
+ * @param size stores the number of processes in the communicator
+ * @param dims how many processes to put in each dimension, 0 to let MPI decide,
+ *        and stores how many are in each dimension
  * @param cart_comm the cartesian communicator for the processes
+ * @return 0 on success, or -1 if the processes cannot be laid out as dims asks
  */
-void get_cart_comm (int * rank, int * size, int * dims, MPI_Comm * cart_comm) {
+int get_cart_comm (MPI_Comm comm, int * rank, int * size, int * dims, MPI_Comm * cart_comm) {
     /* periodic only in one dimension */
     int periods[2]  = {1,0};
-    /* let MPI decide the best dimensions */
+
+    MPI_Comm_size(comm, size);
+    /* MPI_Dims_create keeps the dimensions that are set, but they must divide the size */
+    if (dims[0] < 0 || dims[1] < 0) return -1;
+    if (dims[0] > 0 && *size % dims[0] != 0) return -1;
+    if (dims[1] > 0 && *size % dims[1] != 0) return -1;
+    if (dims[0] > 0 && dims[1] > 0 && dims[0]*dims[1] != *size) return -1;
     MPI_Dims_create(*size, 2, dims);
-    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, cart_comm);
+    MPI_Cart_create(comm, 2, dims, periods, 1, cart_comm);
     /* double check rank, in case Cart_create reordered them */
     MPI_Comm_rank(*cart_comm, rank);
+    return 0;
+}
+
+/**
+ * @brief Free a communicator from ::get_cart_comm
+ * @param cart_comm the cartesian communicator to free
+ */
+void free_cart_comm (MPI_Comm * cart_comm) {
+    MPI_Comm_free(cart_comm);
 }
 
 /**
@@ -53,24 +75,22 @@ void get_cart_comm (int * rank, int * size, int * dims, MPI_Comm * cart_comm) {
  * @param rank the rank of the process calling the function
  * @param size the number of processes in the communicator
  * @param img_dim the dimensions of the local and global data
- * @param local where the data is being scattered to
- * @param global the data source
+ * @param local where the edge data is being scattered to
+ * @param global the edge data source
  */
-void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global) {
+void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, edgenum ** local, edgenum ** global) {
     /* Send data back to rank 0 */
     int i;
-    int offset_m, offset_n;
     int num_req = 0;
-    int coords[2] = {0,0};
+    int coords[2], offset[2], length[2];
     MPI_Request requests[size+1];
     MPI_Status  statuses[size+1];
     MPI_Datatype send_array_type;
     MPI_Datatype recv_array_type;
+    double t = trace_begin();
 
-    /* derived type for sending and receiving */
-    MPI_Type_vector(img_dim.mp, img_dim.np, img_dim.n,  MPI_REALNUM, &send_array_type);
-    MPI_Type_vector(img_dim.mp, img_dim.np, (img_dim.np)+2,  MPI_REALNUM, &recv_array_type);
-    MPI_Type_commit(&send_array_type);
+    /* derived type for receiving, rows are padded to the grid stride */
+    MPI_Type_vector(img_dim.mp, img_dim.np, grid_stride(local),  MPI_EDGENUM, &recv_array_type);
     MPI_Type_commit(&recv_array_type);
 
     if (rank != 0 ) {
@@ -82,16 +102,20 @@ void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_
         MPI_Irecv(&local[1][1], 1, recv_array_type, 0, rank, cart_comm, &requests[size]);
         num_req++;
         for (i = 0; i < size; i++) {
-            /* get the coords of the receiver */
-            MPI_Cart_coords(cart_comm, i, 2, coords);
-            /* calculate the where the data should be sent from */
-            offset_m = coords[0]*img_dim.mp;
-            offset_n = coords[1]*img_dim.np;
-            MPI_Issend(&global[offset_m][offset_n], 1, send_array_type, i, i, cart_comm, &requests[i]);
+            /* calculate the where the data should be sent from, the tiles need not be the same size */
+            tile_extent(cart_comm, i, img_dim, coords, offset, length);
+            /* derived type for sending, only rank zero has the global data */
+            MPI_Type_vector(length[0], length[1], grid_stride(global),  MPI_EDGENUM, &send_array_type);
+            MPI_Type_commit(&send_array_type);
+            MPI_Issend(&global[offset[0]][offset[1]], 1, send_array_type, i, i, cart_comm, &requests[i]);
+            MPI_Type_free(&send_array_type);
             num_req++;
         }
     }
     MPI_Waitall(num_req, requests, statuses);
+
+    MPI_Type_free(&recv_array_type);
+    trace_end("scatter", t);
 }
 
 /**
@@ -100,24 +124,40 @@ void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_
  * @param rank the rank of the process calling the function
  * @param size the number of processes in the communicator
  * @param img_dim the dimensions of the local and global data
- * @param local where the data is being scattered to
- * @param global the data source
+ * @param local the grey levels being gathered, see ::quantise
+ * @param global where the grey levels are gathered to
+ */
+void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global) {
+    int num_req;
+    MPI_Request requests[size+1];
+    double t = trace_begin();
+
+    gather_start(cart_comm, rank, size, img_dim, local, global, requests, &num_req);
+    MPI_Waitall(num_req, requests, MPI_STATUSES_IGNORE);
+    trace_end("gather", t);
+}
+
+/**
+ * @brief Starts gathering local, on all processes, to global, on process 0. See ::gather_data
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param size the number of processes in the communicator
+ * @param img_dim the dimensions of the local and global data
+ * @param local the grey levels being gathered, which must not change until the gather completes
+ * @param global where the grey levels are gathered to
+ * @param requests stores the requests to complete, room for size+1
+ * @param count stores the number of requests
  */
-void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global) {
+void gather_start (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global, MPI_Request * requests, int * count) {
     int i;
-    int offset_m, offset_n;
     int num_req = 0;
-    int coords[2] = {0,0};
-    MPI_Request requests[size+1];
-    MPI_Status  statuses[size+1];
+    int coords[2], offset[2], length[2];
     MPI_Datatype send_array_type;
     MPI_Datatype recv_array_type;
 
-    /* derived type for sending and receiving */
-    MPI_Type_vector(img_dim.mp, img_dim.np, img_dim.np+2,  MPI_REALNUM, &send_array_type);
-    MPI_Type_vector(img_dim.mp, img_dim.np, img_dim.n,   MPI_REALNUM, &recv_array_type);
+    /* derived type for sending, rows are padded to the grid stride */
+    MPI_Type_vector(img_dim.mp, img_dim.np, grid_stride(local),  MPI_GREYNUM, &send_array_type);
     MPI_Type_commit(&send_array_type);
-    MPI_Type_commit(&recv_array_type);
 
     if (rank != 0 ) {
         /* all ranks (other than zero) sent to zero */
@@ -128,16 +168,93 @@ void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_d
         MPI_Issend(&local[1][1], 1, send_array_type, 0, rank, cart_comm, &requests[size]);
         num_req++;
         for (i = 0; i < size; i++) {
-            /* get the coords of the sender */
-            MPI_Cart_coords(cart_comm, i, 2, coords);
-            /* calculate the where the data should be received to */
-            offset_m = coords[0]*img_dim.mp;
-            offset_n = coords[1]*img_dim.np;
-            MPI_Irecv(&global[offset_m][offset_n], 1, recv_array_type, i, i, cart_comm, &requests[i]);
+            /* calculate the where the data should be received to, the tiles need not be the same size */
+            tile_extent(cart_comm, i, img_dim, coords, offset, length);
+            /* derived type for receiving, only rank zero has the global data */
+            MPI_Type_vector(length[0], length[1], grid_stride(global),   MPI_GREYNUM, &recv_array_type);
+            MPI_Type_commit(&recv_array_type);
+            MPI_Irecv(&global[offset[0]][offset[1]], 1, recv_array_type, i, i, cart_comm, &requests[i]);
+            /* the types are kept until the pending operations complete */
+            MPI_Type_free(&recv_array_type);
             num_req++;
         }
     }
-    MPI_Waitall(num_req, requests, statuses);
+    *count = num_req;
+
+    MPI_Type_free(&send_array_type);
+}
+
+/**
+ * @brief Find the overlap of two tiles
+ * @param offset where the first tile starts in each dim
+ * @param length the size of the first tile in each dim
+ * @param other_offset where the second tile starts in each dim
+ * @param other_length the size of the second tile in each dim
+ * @param start stores where the overlap starts in each dim
+ * @param end stores where the overlap ends in each dim
+ * @return 1 if the tiles overlap, otherwise 0
+ */
+static int tile_overlap (int * offset, int * length, int * other_offset, int * other_length, int * start, int * end) {
+    int d, overlap = 1;
+
+    for (d = 0; d < 2; d++) {
+        start[d] = offset[d] > other_offset[d] ? offset[d] : other_offset[d];
+        end[d] = offset[d] + length[d] < other_offset[d] + other_length[d] ? offset[d] + length[d] : other_offset[d] + other_length[d];
+        if (end[d] <= start[d]) overlap = 0;
+    }
+    return overlap;
+}
+
+/**
+ * @brief Moves tile data from one partition of the image to another. Each process sends
+ *        the parts of its old tile that lie in other processes' new tiles, which unless the
+ *        partition changes a lot are only its neighbours', and receives the parts of its new tile.
+ *        Only the tiles are moved, not their halos.
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param size the number of processes in the communicator
+ * @param from the dimensions of the old partition
+ * @param to the dimensions of the new partition
+ * @param type the MPI type of the elements of the grids
+ * @param src the grid of the old tile
+ * @param dst the grid of the new tile, which must not be src
+ */
+void migrate_tile (MPI_Comm cart_comm, int rank, int size, image_dimensions from, image_dimensions to, MPI_Datatype type, void * src, void * dst) {
+    int i, num_req = 0, bytes;
+    int coords[2], old_offset[2], old_length[2], new_offset[2], new_length[2], offset[2], length[2], start[2], end[2];
+    MPI_Request requests[2*size];
+    MPI_Datatype part_type;
+    /* the grids are arrays of rows, which hold elements of any type */
+    char ** src_rows = (char **) src, ** dst_rows = (char **) dst;
+    double t = trace_begin();
+
+    MPI_Type_size(type, &bytes);
+    tile_extent(cart_comm, rank, from, coords, old_offset, old_length);
+    tile_extent(cart_comm, rank, to, coords, new_offset, new_length);
+
+    for (i = 0; i < size; i++) {
+        /* the part of the old tile in process i's new tile */
+        tile_extent(cart_comm, i, to, coords, offset, length);
+        if (tile_overlap(old_offset, old_length, offset, length, start, end)) {
+            MPI_Type_vector(end[0] - start[0], end[1] - start[1], grid_stride(src), type, &part_type);
+            MPI_Type_commit(&part_type);
+            MPI_Isend(src_rows[start[0] - old_offset[0] + 1] + (start[1] - old_offset[1] + 1)*bytes, 1, part_type,
+                i, 0, cart_comm, &requests[num_req++]);
+            MPI_Type_free(&part_type);
+        }
+
+        /* the part of the new tile in process i's old tile */
+        tile_extent(cart_comm, i, from, coords, offset, length);
+        if (tile_overlap(new_offset, new_length, offset, length, start, end)) {
+            MPI_Type_vector(end[0] - start[0], end[1] - start[1], grid_stride(dst), type, &part_type);
+            MPI_Type_commit(&part_type);
+            MPI_Irecv(dst_rows[start[0] - new_offset[0] + 1] + (start[1] - new_offset[1] + 1)*bytes, 1, part_type,
+                i, 0, cart_comm, &requests[num_req++]);
+            MPI_Type_free(&part_type);
+        }
+    }
+    MPI_Waitall(num_req, requests, MPI_STATUSES_IGNORE);
+    trace_end("migrate", t);
 }
 
 /**
@@ -148,5 +265,150 @@ void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_d
  * @param global the number to store the reduced version
  */
 void reduce (MPI_Comm cart_comm, MPI_Op op, real * local, real * global) {
+    double t = trace_begin();
+
     MPI_Allreduce(local, global, 1, MPI_REALNUM, op, cart_comm);
+    trace_end("reduce", t);
+}
+
+/**
+ * @brief Add two arrays of ::repro_sum, as an MPI_Op
+ * @param in the sums to add
+ * @param inout the sums to add to
+ * @param len the number of sums
+ * @param type unused
+ */
+static void repro_op (void * in, void * inout, int * len, MPI_Datatype * type) {
+    repro_sum a, b;
+    int k;
+
+    /* MPI's buffers may not be aligned for 128 bit integers */
+    for (k = 0; k < *len; k++) {
+        memcpy(&a, (char *) in + k*sizeof(repro_sum), sizeof(repro_sum));
+        memcpy(&b, (char *) inout + k*sizeof(repro_sum), sizeof(repro_sum));
+        repro_merge(&b, &a);
+        memcpy((char *) inout + k*sizeof(repro_sum), &b, sizeof(repro_sum));
+    }
+}
+
+/**
+ * @brief Performs an Allreduce for a ::repro_sum, which gives the same bits whatever the
+ *        number of processes and the order MPI combines them in
+ * @param cart_comm the cartesian communicator for the processes
+ * @param local each process's sum
+ * @param global the number to store the rounded total in
+ */
+void reduce_repro (MPI_Comm cart_comm, repro_sum * local, real * global) {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    static MPI_Op op;
+    repro_sum total;
+    double t = trace_begin();
+
+    /* kept until MPI is finalised */
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(sizeof(repro_sum), MPI_BYTE, &type);
+        MPI_Type_commit(&type);
+        MPI_Op_create(repro_op, 1, &op);
+    }
+
+    MPI_Allreduce(local, &total, 1, type, op, cart_comm);
+    *global = repro_value(&total);
+    trace_end("reduce", t);
+}
+
+/**
+ * @brief Starts an Allreduce for an array of real numbers, see ::requests_test
+ * @param comm the communicator
+ * @param op the operation to perform on the reduce
+ * @param local each process's numbers, which must not change until the reduce completes
+ * @param global stores the reduced numbers
+ * @param count the number of numbers
+ * @param request stores the request to complete
+ */
+void reduce_start (MPI_Comm comm, MPI_Op op, real * local, real * global, int count, MPI_Request * request) {
+    MPI_Iallreduce(local, global, count, MPI_REALNUM, op, comm, request);
+}
+
+/**
+ * @brief Check if requests have completed
+ * @param count the number of requests
+ * @param requests the requests
+ * @param wait 1 to wait for them to complete
+ * @return 1 if they have all completed, otherwise 0
+ */
+int requests_test (int count, MPI_Request * requests, int wait) {
+    int done;
+
+    if (wait) {
+        MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+        return 1;
+    }
+    MPI_Testall(count, requests, &done, MPI_STATUSES_IGNORE);
+    return done;
+}
+
+/**
+ * @brief Duplicate a communicator, keeping its topology
+ * @param comm the communicator
+ * @param new_comm stores the duplicate, free it with ::free_comm
+ */
+void dup_comm (MPI_Comm comm, MPI_Comm * new_comm) {
+    MPI_Comm_dup(comm, new_comm);
+}
+
+/**
+ * @brief Broadcasts a block of memory from process 0.
+ * @param comm the communicator to broadcast over
+ * @param data the memory to broadcast, or receive in to
+ * @param bytes the size of the memory
+ */
+void broadcast (MPI_Comm comm, void * data, int bytes) {
+    MPI_Bcast(data, bytes, MPI_BYTE, 0, comm);
+}
+
+/**
+ * @brief Split off a communicator for some of the processes.
+ * @param comm the communicator to split
+ * @param member 1 if the calling process should be in the new communicator
+ * @param new_comm stores the new communicator, or MPI_COMM_NULL if not a member
+ */
+void split_comm (MPI_Comm comm, int member, MPI_Comm * new_comm) {
+    int rank;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split(comm, member ? 0 : MPI_UNDEFINED, rank, new_comm);
+}
+
+/**
+ * @brief Free a communicator from ::split_comm or ::dup_comm
+ * @param comm the communicator to free
+ */
+void free_comm (MPI_Comm * comm) {
+    MPI_Comm_free(comm);
+}
+
+/**
+ * @brief Gathers a block of memory from every process on to process 0.
+ * @param comm the communicator to gather over
+ * @param rank the rank of the process calling the function
+ * @param size the number of processes in the communicator
+ * @param local the memory to send
+ * @param bytes the size of the memory to send, which can differ between processes
+ * @param counts stores the number of bytes from each process, on process 0
+ * @return the memory from every process in rank order, allocated on process 0, otherwise NULL
+ */
+char * gather_bytes (MPI_Comm comm, int rank, int size, void * local, int bytes, int * counts) {
+    int i;
+    int displs[size];
+    char * global = NULL;
+
+    MPI_Gather(&bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        displs[0] = 0;
+        for (i = 1; i < size; i++) displs[i] = displs[i-1] + counts[i-1];
+        global = (char *) malloc(displs[size-1] + counts[size-1] + 1);
+    }
+    MPI_Gatherv(local, bytes, MPI_BYTE, global, counts, displs, MPI_BYTE, 0, comm);
+
+    return global;
 }
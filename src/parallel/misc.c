@@ -39,26 +39,61 @@
  */
 void sawtooth (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** old) {
     int i;
-    int offset_m;
-    int coords[2] = {0,0};
+    int coords[2], offset[2], length[2];
     real val;
 
-    /* make sure the coordinates are correct */
-    MPI_Cart_coords(cart_comm, rank, 2, coords);
-
     /* calculate the offset of the local data in the global image */
-    offset_m = coords[0]*img_dim.mp;
+    tile_extent(cart_comm, rank, img_dim, coords, offset, length);
 
     /* create the sawtooth value for a local process, taking the global size in to account */
     for (i = 1; i < (img_dim.mp + 1); i++) {
       /* compute sawtooth value */
-      val = boundaryval(offset_m + i, img_dim.m);
+      val = boundaryval(offset[0] + i, img_dim.m);
 
       old[i][0]   = 255.0*val;
       old[i][img_dim.np+1] = 255.0*(1.0-val);
     }
 }
 
+/**
+ * @brief Find where a process's tile lies in the global image
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process, which need not be the calling one
+ * @param img_dim the dimensions of the local and global data
+ * @param coords stores the coordinates of the process
+ * @param offset stores where the tile starts in each dim
+ * @param length stores the size of the tile in each dim
+ */
+void tile_extent (MPI_Comm cart_comm, int rank, image_dimensions img_dim, int * coords, int * offset, int * length) {
+    int d;
+
+    MPI_Cart_coords(cart_comm, rank, 2, coords);
+    for (d = 0; d < 2; d++) {
+        if (img_dim.cuts[d] != NULL) {
+            offset[d] = img_dim.cuts[d][coords[d]];
+            length[d] = img_dim.cuts[d][coords[d]+1] - offset[d];
+        } else {
+            /* every tile is the size of this one */
+            length[d] = d == 0 ? img_dim.mp : img_dim.np;
+            offset[d] = coords[d]*length[d];
+        }
+    }
+}
+
+/**
+ * @brief Find which sawtooth boundaries the process owns, rather than getting them as halos
+ * @param cart_comm the cartesian communicator for the processes
+ * @param low set to 1 if the process owns column 0, otherwise 0
+ * @param high set to 1 if the process owns column np+1, otherwise 0
+ */
+void boundary_sides (MPI_Comm cart_comm, int * low, int * high) {
+    int i_down, i_up;
+
+    MPI_Cart_shift(cart_comm, 1, 1, &i_down, &i_up);
+    *low  = (i_down == MPI_PROC_NULL);
+    *high = (i_up == MPI_PROC_NULL);
+}
+
 /**
  * @brief Get the current wall time (Wrapper for MPI_Wtime)
  * @return time in seconds since an arbitrary point in the past
@@ -67,6 +102,47 @@ double get_time () {
     return MPI_Wtime();
 }
 
+/** Round trips timed to each process by ::clock_offset */
+#define CLOCK_ROUNDS 8
+
+/**
+ * @brief Estimate how far each process's clock is ahead of process 0's, from the
+ *        quickest of several round trips. Called by every process
+ * @param comm the communicator of the processes
+ * @param rank the rank of the process calling the function
+ * @param size the number of processes in the communicator
+ * @return the offset of the calling process's clock, in seconds
+ */
+double clock_offset (MPI_Comm comm, int rank, int size) {
+    int r, k;
+    double t0, t1, remote, best = 0.0, offset = 0.0;
+
+    for (r = 1; r < size; r++) {
+        if (rank == 0) {
+            for (k = 0; k < CLOCK_ROUNDS; k++) {
+                t0 = MPI_Wtime();
+                MPI_Send(&t0, 1, MPI_DOUBLE, r, 5, comm);
+                MPI_Recv(&remote, 1, MPI_DOUBLE, r, 6, comm, MPI_STATUS_IGNORE);
+                t1 = MPI_Wtime();
+                /* the remote clock was read half way through the quickest trip */
+                if (k == 0 || t1 - t0 < best) {
+                    best = t1 - t0;
+                    offset = remote - 0.5*(t0 + t1);
+                }
+            }
+            MPI_Send(&offset, 1, MPI_DOUBLE, r, 7, comm);
+        } else if (rank == r) {
+            for (k = 0; k < CLOCK_ROUNDS; k++) {
+                MPI_Recv(&t0, 1, MPI_DOUBLE, 0, 5, comm, MPI_STATUS_IGNORE);
+                remote = MPI_Wtime();
+                MPI_Send(&remote, 1, MPI_DOUBLE, 0, 6, comm);
+            }
+            MPI_Recv(&offset, 1, MPI_DOUBLE, 0, 7, comm, MPI_STATUS_IGNORE);
+        }
+    }
+    return rank == 0 ? 0.0 : offset;
+}
+
 /**
  * @brief Initialise MPI
  * @param argc to pass arguments to MPI
@@ -75,14 +151,24 @@ double get_time () {
  * @param size pointer so the size can be designated
  */
 void init (int argc, char * argv[], int * rank, int * size) {
-    int initialized;
+    int initialized, provided;
 
+    /* streamed frames are read and snapshots written on second threads, which make no MPI calls */
     MPI_Initialized(&initialized);
     if (!initialized)
-        MPI_Init(&argc, &argv);
+        MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    else
+        MPI_Query_thread(&provided);
 
     MPI_Comm_rank(MPI_COMM_WORLD, rank);
     MPI_Comm_size(MPI_COMM_WORLD, size);
+
+    /* MPI_THREAD_SINGLE allows no other threads at all */
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (*rank == 0)
+            fprintf(stderr, "MPI only provides thread level %d, and MPI_THREAD_FUNNELED is needed\n", provided);
+        m_abort();
+    }
 }
 
 /**
@@ -24,12 +24,395 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <mpi.h>
 #include <math.h>
+#include <float.h>
 
+#include <grid.h>
+#include <trace.h>
+#include <counters.h>
 #include <precision.h>
 #include <functions.h>
 
+/** A persistent halo swap, kept while the same grid is swapped with the same neighbours */
+typedef struct {
+    real ** old;              /**< The grid the requests point in to, or NULL if there is no plan */
+    int stride;               /**< The row stride of the grid */
+    image_dimensions img_dim; /**< The dimensions of the grid */
+    MPI_Comm cart_comm;       /**< The communicator of the requests */
+    MPI_Request requests[8];  /**< The sends and receives */
+    MPI_Datatype i_halo;      /**< Derived type for halo swaps between horizontal neighbours */
+    int reduced;              /**< 1 if the halos are sent as floats, see ::halo_precision */
+    float * buf[8];           /**< The packed halos of each request, if reduced */
+    int length[8];            /**< The number of values in each request */
+    int source[4];            /**< The process each receive is from */
+    int unpacked;             /**< The receives of the swap in flight already unpacked, a bit each */
+} halo_plan;
+
+/**
+ * The new values kept by ::update_in_place. The outer two rings of the tile are only written
+ * back once the halo swap is done, as the sends read the outer ring and the outer ring's new
+ * values need the old values of the second.
+ */
+typedef struct {
+    int mp;          /**< The tile size in dim 0 the rows and columns are laid out for */
+    int np;          /**< The tile size in dim 1 */
+    real * block;    /**< Every row and column, in one allocation */
+    real * roll[2];  /**< The new values of the last two rows of the interior computed */
+    real * row[4];   /**< The new values of rows 1, 2, mp-1 and mp */
+    real * col[4];   /**< The new values of columns 1, 2, np-1 and np of the other rows */
+} frame_rows;
+
+/** What the updates keep between calls, one for each context, see ::update_state_create */
+struct update_state {
+    halo_plan plan;     /**< The persistent halo swap */
+    frame_rows frame;   /**< The rows and columns kept by ::update_in_place */
+};
+
+/** Whether the next halo swaps are sent as floats, see ::halo_precision */
+static int halo_reduced = 0;
+
+/** The largest halo value sent as a float since ::halo_precision, see ::halo_rounding */
+static real halo_largest = 0.0;
+
+/** How the halo swaps went, see ::halo_timing */
+static struct {
+    int poll_rows;     /**< Rows of the interior between tests of the swap, 0 to only wait */
+    int done;          /**< Whether the swap in flight has completed */
+    int swaps;         /**< Swaps started */
+    int ready;         /**< Swaps a test during the interior sweep found complete */
+    double wait;       /**< Seconds spent waiting for swaps to complete */
+} timing = {0};
+
+/**
+ * @brief Set how often the interior sweep tests the halo swap. MPI is initialised
+ *        MPI_THREAD_FUNNELED, so the main thread has to make the calls that move the halos.
+ * @param rows the rows of the interior between tests, 0 to only wait once it is done
+ */
+void halo_poll (int rows) {
+    timing.poll_rows = rows;
+}
+
+/**
+ * @brief Get and reset how many halo swaps were complete by the end of the interior sweep
+ *        and the time spent waiting for the rest. When a swap completes between two tests
+ *        is not known, so how much of its latency was hidden cannot be measured.
+ * @param swaps stores the number of swaps started
+ * @param ready stores the number a test during the interior sweep found complete
+ * @param wait stores the seconds spent waiting for swaps
+ */
+void halo_timing (int * swaps, int * ready, double * wait) {
+    *swaps = timing.swaps;
+    *ready = timing.ready;
+    *wait = timing.wait;
+    timing.swaps = 0;
+    timing.ready = 0;
+    timing.wait = 0.0;
+}
+
+/**
+ * @brief Get the time spent waiting for halo swaps since ::halo_timing last reset it,
+ *        without resetting it
+ * @return the seconds spent waiting
+ */
+double halo_waited () {
+    return timing.wait;
+}
+
+/**
+ * @brief Free a persistent halo swap, if there is one
+ * @param plan the swap
+ */
+static void halo_free (halo_plan * plan) {
+    int r;
+
+    if (plan->old == NULL) return;
+
+    for (r = 0; r < 8; r++) MPI_Request_free(&(plan->requests[r]));
+    MPI_Type_free(&(plan->i_halo));
+    if (plan->reduced) {
+        for (r = 0; r < 8; r++) free(plan->buf[r]);
+    }
+    plan->old = NULL;
+}
+
+/**
+ * @brief Free the persistent halo swap of a context, so the next update sets it up again
+ * @param state the state of the context's updates
+ */
+void halo_release (update_state * state) {
+    halo_free(&(state->plan));
+}
+
+/**
+ * @brief Create the state the updates keep between calls. Nothing is set up until it is used
+ * @return the state
+ */
+update_state * update_state_create () {
+    update_state * state = (update_state *) calloc(1, sizeof(update_state));
+
+    state->plan.old = NULL;
+    state->frame.block = NULL;
+    return state;
+}
+
+/**
+ * @brief Free the state the updates keep between calls, before the communicator it was used on
+ * @param state the state, or NULL
+ */
+void update_state_free (update_state * state) {
+    if (state == NULL) return;
+
+    halo_release(state);
+    free(state->frame.block);
+    free(state);
+}
+
+/**
+ * @brief Set whether halos are swapped as floats, halving the bytes sent. Rounding a halo
+ *        moves its value by up to 6e-8 of it, which for grey levels up to 255 is around 1e-5,
+ *        and the solve converges to an image that far off. That is above small deltas such
+ *        as 1e-7, so a solve must finish with full precision halos, see ::halo_rounding.
+ * @param reduced 1 to send floats, 0 to send full precision
+ */
+void halo_precision (int reduced) {
+    halo_reduced = reduced;
+    halo_largest = 0.0;
+}
+
+/**
+ * @brief Bound the rounding of the halos sent as floats since ::halo_precision, which is
+ *        how close to the full precision solution a solve with float halos can get. The
+ *        bound holds as long as the halos stay as large as they have been.
+ * @return half a float's epsilon of the largest halo value sent
+ */
+real halo_rounding () {
+    return 0.5 * FLT_EPSILON * halo_largest;
+}
+
+/**
+ * @brief Round a value to send as a float, keeping track of the largest value
+ * @param value the value
+ * @param largest the largest magnitude so far, updated
+ * @return the float to send
+ */
+static inline float halo_round (real value, real * largest) {
+    if (fabs(value) > *largest) *largest = fabs(value);
+    return (float) value;
+}
+
+/**
+ * @brief Copy the edges of old in to the float send buffers, rounding them
+ * @param plan the swap
+ * @param old the grid being swapped
+ */
+static void halo_pack (halo_plan * plan, real ** old) {
+    int k, mp = plan->img_dim.mp, np = plan->img_dim.np;
+    real largest = halo_largest;
+
+    for (k = 0; k < np; k++) {
+        plan->buf[0][k] = halo_round(old[mp][k+1], &largest);
+        plan->buf[1][k] = halo_round(old[1][k+1], &largest);
+    }
+    for (k = 0; k < mp; k++) {
+        plan->buf[2][k] = halo_round(old[k+1][np], &largest);
+        plan->buf[3][k] = halo_round(old[k+1][1], &largest);
+    }
+    halo_largest = largest;
+}
+
+/**
+ * @brief Copy a received float halo in to the grid, if it has not been already
+ * @param plan the swap
+ * @param r the receive, 0 to 3 for plan->requests[4..7]
+ */
+static void halo_unpack (halo_plan * plan, int r) {
+    int k, mp = plan->img_dim.mp, np = plan->img_dim.np;
+    float * buf = plan->buf[4+r];
+    real ** old = plan->old;
+
+    /* nothing arrives past the top and bottom of the image, the sawtooth stays */
+    if (!plan->reduced || (plan->unpacked & (1 << r)) || plan->source[r] == MPI_PROC_NULL) return;
+    plan->unpacked |= 1 << r;
+
+    switch (r) {
+        case 0: for (k = 0; k < np; k++) old[0][k+1] = buf[k]; break;
+        case 1: for (k = 0; k < np; k++) old[mp+1][k+1] = buf[k]; break;
+        case 2: for (k = 0; k < mp; k++) old[k+1][np+1] = buf[k]; break;
+        case 3: for (k = 0; k < mp; k++) old[k+1][0] = buf[k]; break;
+    }
+}
+
+/**
+ * @brief Start swapping the halos of old with the neighbouring processes. The requests are
+ *        set up on the first swap of a grid and reused until a different grid is swapped.
+ * @param plan the swap
+ * @param cart_comm the cartesian communicator for the processes
+ * @param img_dim the dimensions of the local and global data
+ * @param old the array to swap the halos of
+ */
+static void halo_start (halo_plan * plan, MPI_Comm cart_comm, image_dimensions img_dim, real ** old) {
+    int i_up, i_down, j_up, j_down, r;
+    double t = trace_begin();
+
+    if (plan->old != old || plan->stride != grid_stride(old) || plan->cart_comm != cart_comm
+        || plan->img_dim.mp != img_dim.mp || plan->img_dim.np != img_dim.np || plan->reduced != halo_reduced) {
+        halo_free(plan);
+
+        /* derived type for halo swaps between horizontal neighbours */
+        MPI_Type_vector(img_dim.mp, 1, grid_stride(old),  MPI_REALNUM, &(plan->i_halo));
+        MPI_Type_commit(&(plan->i_halo));
+
+        /* find neighbours */
+        MPI_Cart_shift(cart_comm, 0, 1, &j_down, &j_up);
+        MPI_Cart_shift(cart_comm, 1, 1, &i_down, &i_up);
+
+        plan->source[0] = j_down;
+        plan->source[1] = j_up;
+        plan->source[2] = i_up;
+        plan->source[3] = i_down;
+
+        if (halo_reduced) {
+            /* the edges are packed as floats, see ::halo_pack and ::halo_unpack */
+            for (r = 0; r < 8; r++) {
+                plan->length[r] = (r % 4 < 2) ? img_dim.np : img_dim.mp;
+                plan->buf[r] = (float *) malloc(plan->length[r] * sizeof(float));
+            }
+            MPI_Ssend_init(plan->buf[0], plan->length[0], MPI_FLOAT,   j_up, 1, cart_comm, &(plan->requests[0]));
+            MPI_Ssend_init(plan->buf[1], plan->length[1], MPI_FLOAT, j_down, 2, cart_comm, &(plan->requests[1]));
+            MPI_Ssend_init(plan->buf[2], plan->length[2], MPI_FLOAT,   i_up, 4, cart_comm, &(plan->requests[2]));
+            MPI_Ssend_init(plan->buf[3], plan->length[3], MPI_FLOAT, i_down, 3, cart_comm, &(plan->requests[3]));
+
+            MPI_Recv_init(plan->buf[4], plan->length[4], MPI_FLOAT, j_down, 1, cart_comm, &(plan->requests[4]));
+            MPI_Recv_init(plan->buf[5], plan->length[5], MPI_FLOAT,   j_up, 2, cart_comm, &(plan->requests[5]));
+            MPI_Recv_init(plan->buf[6], plan->length[6], MPI_FLOAT,   i_up, 3, cart_comm, &(plan->requests[6]));
+            MPI_Recv_init(plan->buf[7], plan->length[7], MPI_FLOAT, i_down, 4, cart_comm, &(plan->requests[7]));
+        } else {
+            /* synchronous sends, so data cannot be modifed until send/recv completes */
+            MPI_Ssend_init(&old[img_dim.mp][1], img_dim.np, MPI_REALNUM,   j_up, 1, cart_comm, &(plan->requests[0]));
+            MPI_Ssend_init(&old[1][1],          img_dim.np, MPI_REALNUM, j_down, 2, cart_comm, &(plan->requests[1]));
+            MPI_Ssend_init(&old[1][img_dim.np],    1, plan->i_halo,   i_up, 4, cart_comm, &(plan->requests[2]));
+            MPI_Ssend_init(&old[1][1],             1, plan->i_halo, i_down, 3, cart_comm, &(plan->requests[3]));
+
+            MPI_Recv_init(&old[0][1],            img_dim.np, MPI_REALNUM, j_down, 1, cart_comm, &(plan->requests[4]));
+            MPI_Recv_init(&old[img_dim.mp+1][1], img_dim.np, MPI_REALNUM,   j_up, 2, cart_comm, &(plan->requests[5]));
+            MPI_Recv_init(&old[1][img_dim.np+1],    1, plan->i_halo,   i_up, 3, cart_comm, &(plan->requests[6]));
+            MPI_Recv_init(&old[1][0],               1, plan->i_halo, i_down, 4, cart_comm, &(plan->requests[7]));
+        }
+
+        plan->reduced = halo_reduced;
+        plan->old = old;
+        plan->stride = grid_stride(old);
+        plan->img_dim = img_dim;
+        plan->cart_comm = cart_comm;
+    }
+
+    if (plan->reduced) halo_pack(plan, old);
+    plan->unpacked = 0;
+
+    /* non blocking send/recv of halos */
+    MPI_Startall(8, plan->requests);
+    timing.done = 0;
+    timing.swaps++;
+    trace_end("halo post", t);
+}
+
+/**
+ * @brief Test the halo swap started by ::halo_start, so MPI can move the halos along.
+ * @param plan the swap
+ */
+static void halo_test (halo_plan * plan) {
+    int r;
+
+    if (timing.done) return;
+
+    MPI_Testall(8, plan->requests, &(timing.done), MPI_STATUSES_IGNORE);
+    if (timing.done) {
+        timing.ready++;
+        for (r = 0; r < 4; r++) halo_unpack(plan, r);
+    }
+}
+
+/** The halo each receive of the swap fills, as a ::halo_need bit, in the order of plan->requests[4..7] */
+static const int halo_side[4] = {1, 2, 8, 4};
+
+/**
+ * @brief Find which halos a boundary pixel needs
+ * @param img_dim the dimensions of the local and global data
+ * @param i the pixel's position in dim 0
+ * @param j the pixel's position in dim 1
+ * @return a bit for each halo: 1 and 2 for rows 0 and mp+1, 4 and 8 for columns 0 and np+1
+ */
+static int halo_need (image_dimensions img_dim, int i, int j) {
+    return (i == 1 ? 1 : 0) | (i == img_dim.mp ? 2 : 0) | (j == 1 ? 4 : 0) | (j == img_dim.np ? 8 : 0);
+}
+
+/**
+ * @brief Wait for at least one more halo of the swap started by ::halo_start to arrive
+ * @param plan the swap
+ * @return the halos that arrived, see ::halo_need
+ */
+static int halo_arrivals (halo_plan * plan) {
+    int r, count, indices[4], arrived = 0;
+    double t, start;
+
+    /* already seen complete while the interior was swept */
+    if (timing.done) return 15;
+
+    t = trace_begin();
+    start = get_time();
+    MPI_Waitsome(4, &(plan->requests[4]), &count, indices, MPI_STATUSES_IGNORE);
+    timing.wait += get_time() - start;
+    trace_end("halo wait", t);
+
+    /* no receives left in flight */
+    if (count == MPI_UNDEFINED) return 15;
+    for (r = 0; r < count; r++) {
+        halo_unpack(plan, indices[r]);
+        arrived |= halo_side[indices[r]];
+    }
+    return arrived;
+}
+
+/**
+ * @brief Wait for the rest of a halo swap started by ::halo_start to complete.
+ * @param plan the swap
+ */
+static void halo_finish (halo_plan * plan) {
+    MPI_Status statuses[8];
+    int r;
+    double t = trace_begin(), start;
+
+    if (!timing.done) {
+        start = get_time();
+        MPI_Waitall(8, plan->requests, statuses);
+        timing.wait += get_time() - start;
+        for (r = 0; r < 4; r++) halo_unpack(plan, r);
+    }
+    trace_end("halo wait", t);
+}
+
+/**
+ * @brief Reconstruct a rectangle of pixels next to the halos
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data
+ * @param new stores the current operation's data
+ * @param i0 the first pixel in dim 0
+ * @param i1 one past the last pixel in dim 0
+ * @param j0 the first pixel in dim 1
+ * @param j1 one past the last pixel in dim 1
+ */
+static void update_strip (edgenum ** edge, real ** old, real ** new, int i0, int i1, int j0, int j1) {
+    int i, j;
+
+    for (i = i0; i < i1; i++) {
+        for (j = j0; j < j1; j++) {
+            new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+        }
+    }
+}
+
 /**
  * @brief Performs one reconstruct operation.
  * @param cart_comm the cartesian communicator for the processes
@@ -38,71 +421,517 @@
  * @param edge stores the original edge data
  * @param old stores the previous operation's data
  * @param new stores the current operation's data
+ * @param state what the updates of the context keep between calls, see ::update_state_create
  * @return both the maximum pixel change and the the average pixel value. See ::step_return
  */
-step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** edge, real ** old, real ** new){
-    int i, j, i_up, i_down, j_up, j_down;
+step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, update_state * state){
+    int i, j, start, end, chunk, r, need, arrived, pending, pixels;
     real delta = 0.0;
-    step_return retval = {0.0, 0.0};
+    step_return retval = {0.0};
+    halo_plan * plan = &(state->plan);
+    double t;
+    /* the edges without their corners, then the corners, as {i0, i1, j0, j1} */
+    int mp = img_dim.mp, np = img_dim.np;
+    int strips[8][4] = {{1, 2, 2, np}, {mp, mp+1, 2, np}, {2, mp, 1, 2}, {2, mp, np, np+1},
+                        {1, 2, 1, 2}, {1, 2, np, np+1}, {mp, mp+1, 1, 2}, {mp, mp+1, np, np+1}};
 
-    MPI_Request requests[8];
-    MPI_Status  statuses[8];
-    MPI_Datatype i_halo;
+    halo_start(plan, cart_comm, img_dim, old);
 
-    /* derived type for halo swaps between horizontal neighbours */
-    MPI_Type_vector(img_dim.mp, 1, (img_dim.np)+2,  MPI_REALNUM, &i_halo);
-    MPI_Type_commit(&i_halo);
+    /* Rather than waiting for halos, keep doing work by
+     * reconstructing the image excluding pixels that need the halos.
+     * Most MPIs only progress the swap inside MPI calls, so test it between chunks */
+    t = trace_begin();
+    counters_start();
+    chunk = timing.poll_rows > 0 ? timing.poll_rows : img_dim.mp;
+    for (start = 2; start < (img_dim.mp); start += chunk) {
+        end = start + chunk < img_dim.mp ? start + chunk : img_dim.mp;
+        for (i = start; i < end; i++) {
+            for (j = 2; j < (img_dim.np); j++) {
+                new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+            }
+        }
+        if (timing.poll_rows > 0) halo_test(plan);
+    }
+    counters_stop(COUNTERS_STENCIL, (img_dim.mp-2)*(img_dim.np-2));
+    trace_end("interior", t);
 
-    /* find neighbours */
-    MPI_Cart_shift(cart_comm, 0, 1, &j_down, &j_up);
-    MPI_Cart_shift(cart_comm, 1, 1, &i_down, &i_up);
+    /* reconstruct each edge and corner as soon as the halos it needs are in, so a late
+     * neighbour only holds up the pixels next to it */
+    arrived = 0;
+    pending = 0;
+    for (r = 0; r < 8; r++) {
+        if (strips[r][0] < strips[r][1] && strips[r][2] < strips[r][3]) pending |= 1 << r;
+    }
+    while (pending != 0) {
+        arrived |= halo_arrivals(plan);
 
+        t = trace_begin();
+        counters_start();
+        pixels = 0;
+        for (r = 0; r < 8; r++) {
+            need = halo_need(img_dim, strips[r][0], strips[r][2]);
+            if (!(pending & (1 << r)) || (arrived & need) != need) continue;
+            update_strip(edge, old, new, strips[r][0], strips[r][1], strips[r][2], strips[r][3]);
+            pixels += (strips[r][1] - strips[r][0]) * (strips[r][3] - strips[r][2]);
+            pending &= ~(1 << r);
+        }
+        counters_stop(COUNTERS_STENCIL, pixels);
+        trace_end("boundary", t);
+    }
 
-    /* non blocking send/recv of halos */
-    /* synchronous sends, so data cannot be modifed until send/recv completes */
-    MPI_Issend(&old[img_dim.mp][1], img_dim.np, MPI_REALNUM,   j_up, 1, cart_comm, &requests[0]);
-    MPI_Issend(&old[1][1],          img_dim.np, MPI_REALNUM, j_down, 2, cart_comm, &requests[1]);
-    MPI_Issend(&old[1][img_dim.np],          1,      i_halo,   i_up, 4, cart_comm, &requests[2]);
-    MPI_Issend(&old[1][1],                   1,      i_halo, i_down, 3, cart_comm, &requests[3]);
+    /* the sends read old, so must complete before it is overwritten */
+    halo_finish(plan);
+    t = trace_begin();
 
-    MPI_Irecv(&old[0][1],            img_dim.np, MPI_REALNUM, j_down, 1, cart_comm, &requests[4]);
-    MPI_Irecv(&old[img_dim.mp+1][1], img_dim.np, MPI_REALNUM,   j_up, 2, cart_comm, &requests[5]);
-    MPI_Irecv(&old[1][img_dim.np+1],          1,      i_halo,   i_up, 3, cart_comm, &requests[6]);
-    MPI_Irecv(&old[1][0],                     1,      i_halo, i_down, 4, cart_comm, &requests[7]);
+    /* set old = new for next iteration, while finding the max delta value */
+    counters_start();
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        if (repro_wanted & REPRO_SQUARE) repro_add_squares(&(retval.square), &(new[i][1]), &(old[i][1]), img_dim.np);
+        for (j = 1; j < (img_dim.np + 1); j++) {
+            delta = fabs(new[i][j] - old[i][j]);
+            if (delta > retval.delta) {
+                retval.delta = delta;
+            }
+            if (repro_wanted & REPRO_SUM) repro_add(&(retval.sum), new[i][j]);
+            old[i][j] = new[i][j];
+        }
+    }
+    counters_stop(COUNTERS_COPY, img_dim.mp*img_dim.np);
+    trace_end("delta", t);
+    return retval;
+}
 
+/**
+ * @brief Lay out the rows and columns kept by ::update_in_place for a tile size
+ * @param frame the rows and columns
+ * @param mp the tile size in dim 0
+ * @param np the tile size in dim 1
+ */
+static void frame_size (frame_rows * frame, int mp, int np) {
+    int k;
 
-    /* Rather than waiting for halos, keep doing work by
-     * reconstructing the image excluding pixels that need the halos */
-    for (i = 2; i < (img_dim.mp); i++) {
-        for (j = 2; j < (img_dim.np); j++) {
-            new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+    if (frame->mp == mp && frame->np == np) return;
+
+    free(frame->block);
+    frame->block = (real *) malloc((6*(np+2) + 4*(mp+2)) * sizeof(real));
+    for (k = 0; k < 2; k++) frame->roll[k] = frame->block + k*(np+2);
+    for (k = 0; k < 4; k++) {
+        frame->row[k] = frame->block + (2+k)*(np+2);
+        frame->col[k] = frame->block + 6*(np+2) + k*(mp+2);
+    }
+    frame->mp = mp;
+    frame->np = np;
+}
+
+/**
+ * @brief Find where ::update_in_place keeps the new value of a pixel of the outer two rings
+ * @param frame the rows and columns
+ * @param i the pixel's position in dim 0
+ * @param j the pixel's position in dim 1
+ * @return the new value
+ */
+static inline real * frame_slot (frame_rows * frame, int i, int j) {
+    if (i <= 2) return &(frame->row[i-1][j]);
+    if (i >= frame->mp-1) return &(frame->row[i-frame->mp+3][j]);
+    if (j <= 2) return &(frame->col[j-1][i]);
+    return &(frame->col[j-frame->np+3][i]);
+}
+
+/**
+ * @brief Replace a pixel with its new value, adding it to the delta and sums of the operation
+ * @param pixel the pixel
+ * @param value its new value
+ * @param retval the ::step_return to add to
+ * @param wanted the sums to add it to, see ::repro_wanted
+ */
+static inline void frame_store (real * pixel, real value, step_return * retval, int wanted) {
+    real delta = fabs(value - *pixel);
+
+    if (delta > retval->delta) retval->delta = delta;
+    if (wanted & REPRO_SUM) repro_add(&(retval->sum), value);
+    if (wanted & REPRO_SQUARE) repro_add(&(retval->square), delta*delta);
+    *pixel = value;
+}
+
+/**
+ * @brief Reconstruct a rectangle of the outer ring, see ::update_strip, keeping the new values aside
+ * @param frame the rows and columns
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data
+ * @param i0 the first pixel in dim 0
+ * @param i1 one past the last pixel in dim 0
+ * @param j0 the first pixel in dim 1
+ * @param j1 one past the last pixel in dim 1
+ */
+static void frame_strip (frame_rows * frame, edgenum ** edge, real ** old, int i0, int i1, int j0, int j1) {
+    int i, j;
+
+    for (i = i0; i < i1; i++) {
+        for (j = j0; j < j1; j++) {
+            *frame_slot(frame, i, j) = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+        }
+    }
+}
+
+/**
+ * @brief Performs one reconstruct operation in place, without a second grid.
+ *
+ * The interior is swept a row at a time in to one of two rows, and each row is written back
+ * once the row after it has been computed, as nothing needs its old values after that. The
+ * outer two rings are kept aside instead and only written back once the halos have arrived
+ * and the swap is done, so every pixel is computed from exactly the same operands as
+ * ::update_tick and the results are identical, while the swap still overlaps the interior.
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param img_dim the dimensions of the local and global data, both at least 4
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data, and the result
+ * @param state what the updates of the context keep between calls, see ::update_state_create
+ * @return both the maximum pixel change and the the average pixel value. See ::step_return
+ */
+step_return update_in_place (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, update_state * state){
+    int i, j, k, r, rows, need, arrived, pending, pixels;
+    step_return retval = {0.0};
+    real * row;
+    halo_plan * plan = &(state->plan);
+    frame_rows * frame = &(state->frame);
+    double t;
+    /* the outer ring without its corners, then the corners, as {i0, i1, j0, j1} */
+    int mp = img_dim.mp, np = img_dim.np;
+    int strips[8][4] = {{1, 2, 2, np}, {mp, mp+1, 2, np}, {2, mp, 1, 2}, {2, mp, np, np+1},
+                        {1, 2, 1, 2}, {1, 2, np, np+1}, {mp, mp+1, 1, 2}, {mp, mp+1, np, np+1}};
+
+    frame_size(frame, mp, np);
+    halo_start(plan, cart_comm, img_dim, old);
+
+    /* rows 2 to mp-1 without the outer ring, so without the halos, testing the swap as in ::update_tick */
+    t = trace_begin();
+    counters_start();
+    rows = 0;
+    for (i = 2; i < mp+1; i++) {
+        if (i < mp) {
+            row = frame->roll[i & 1];
+            for (j = 2; j < np; j++) {
+                row[j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+            }
+        }
+
+        /* row i-1 is no longer needed, other than the second ring by the outer one */
+        if (i > 2) {
+            row = frame->roll[(i-1) & 1];
+            if (i-1 == 2 || i-1 == mp-1) {
+                for (j = 2; j < np; j++) *frame_slot(frame, i-1, j) = row[j];
+            } else {
+                *frame_slot(frame, i-1, 2) = row[2];
+                *frame_slot(frame, i-1, np-1) = row[np-1];
+                /* a whole row of squares at once, see repro_add_squares */
+                if (repro_wanted & REPRO_SQUARE) repro_add_squares(&(retval.square), &(row[3]), &(old[i-1][3]), np-4);
+                for (j = 3; j < np-1; j++) frame_store(&(old[i-1][j]), row[j], &retval, repro_wanted & ~REPRO_SQUARE);
+            }
+        }
+
+        if (timing.poll_rows > 0 && ++rows == timing.poll_rows) {
+            halo_test(plan);
+            rows = 0;
+        }
+    }
+    counters_stop(COUNTERS_STENCIL, (mp-2)*(np-2));
+    trace_end("interior", t);
+
+    /* the outer ring, as soon as the halos it needs are in */
+    arrived = 0;
+    pending = 255;
+    while (pending != 0) {
+        arrived |= halo_arrivals(plan);
+
+        t = trace_begin();
+        counters_start();
+        pixels = 0;
+        for (r = 0; r < 8; r++) {
+            need = halo_need(img_dim, strips[r][0], strips[r][2]);
+            if (!(pending & (1 << r)) || (arrived & need) != need) continue;
+            frame_strip(frame, edge, old, strips[r][0], strips[r][1], strips[r][2], strips[r][3]);
+            pixels += (strips[r][1] - strips[r][0]) * (strips[r][3] - strips[r][2]);
+            pending &= ~(1 << r);
+        }
+        counters_stop(COUNTERS_STENCIL, pixels);
+        trace_end("boundary", t);
+    }
+
+    /* the sends read the outer ring, so must complete before it is overwritten */
+    halo_finish(plan);
+    t = trace_begin();
+
+    counters_start();
+    for (k = 0; k < 4; k++) {
+        i = k < 2 ? k+1 : mp-3+k;
+        for (j = 1; j < np+1; j++) frame_store(&(old[i][j]), frame->row[k][j], &retval, repro_wanted);
+    }
+    for (i = 3; i < mp-1; i++) {
+        for (k = 0; k < 4; k++) {
+            j = k < 2 ? k+1 : np-3+k;
+            frame_store(&(old[i][j]), frame->col[k][i], &retval, repro_wanted);
+        }
+    }
+    counters_stop(COUNTERS_COPY, 4*np + 4*(mp-4));
+    trace_end("delta", t);
+    return retval;
+}
+
+/**
+ * @brief Performs one reconstruct operation, skipping blocks that have converged. See active.c
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param img_dim the dimensions of the local and global data
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data
+ * @param new stores the current operation's data
+ * @param active the state of the blocks
+ * @param state what the updates of the context keep between calls, see ::update_state_create
+ * @return both the maximum pixel change and the the average pixel value. See ::step_return
+ */
+step_return update_active (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, active_blocks * active, update_state * state){
+    step_return retval;
+    double t;
+
+    halo_start(&(state->plan), cart_comm, img_dim, old);
+
+    /* blocks away from the edge do not need the halos */
+    t = trace_begin();
+    active_sweep(active, img_dim, edge, old, new, 0);
+    trace_end("interior", t);
+
+    halo_finish(&(state->plan));
+
+    t = trace_begin();
+    active_sweep(active, img_dim, edge, old, new, 1);
+    retval = active_finish(active, img_dim, old, new);
+    trace_end("boundary and delta", t);
+
+    return retval;
+}
+
+/**
+ * @brief Performs several reconstruct operations. The wavefront engine needs halos as deep
+ *        as the block, so the parallel code takes the operations one at a time.
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param img_dim the dimensions of the local and global data
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data, and the result of the block
+ * @param new stores the current operation's data
+ * @param save if not NULL, stores a copy of old as it was before the block
+ * @param steps the number of operations to perform
+ * @param results stores the ::step_return of each operation
+ * @param state what the updates of the context keep between calls, see ::update_state_create
+ */
+void update_block (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, real ** save, int steps, step_return * results, update_state * state){
+    int s;
+
+    if (save != NULL) copy_tile(img_dim, old, save);
+
+    for (s = 0; s < steps; s++) {
+        results[s] = update_tick(cart_comm, rank, img_dim, edge, old, new, state);
+    }
+}
+
+/** First tag of the halos swapped by ::update_async, clear of the persistent swap's */
+#define ASYNC_TAG 16
+
+/**
+ * Halos swapped without waiting, see ::update_async. Way d is towards the neighbour in
+ * dim d/2, below for even d and above for odd d, and a halo sent way d is received by
+ * that neighbour from way d^1. The tag is ASYNC_TAG plus the way it was sent.
+ */
+static struct {
+    MPI_Comm cart_comm;       /**< The communicator of the swaps */
+    image_dimensions img_dim; /**< The dimensions of the grid */
+    int neighbour[4];         /**< The process each way, or MPI_PROC_NULL */
+    real * send[4];           /**< The edge being sent each way */
+    real * recv[4];           /**< The halo being received from each way */
+    MPI_Request requests[8];  /**< The sends each way, then the receives */
+    int sent[4];              /**< The halos sent each way */
+    int received[4];          /**< The halos received from each way */
+} async;
+
+/**
+ * @brief Copy the edge of old next to way d, or the halo received from it in to old
+ * @param old the grid
+ * @param d the way
+ * @param buf the edge or halo
+ * @param to_grid 1 to copy the halo in to old, 0 to copy the edge out
+ */
+static void async_copy (real ** old, int d, real * buf, int to_grid) {
+    int k, mp = async.img_dim.mp, np = async.img_dim.np;
+    /* the halo row or column, and the edge next to it */
+    int halo = (d % 2 == 0) ? 0 : (d < 2 ? mp+1 : np+1);
+    int edge = (d % 2 == 0) ? 1 : (d < 2 ? mp : np);
+    int line = to_grid ? halo : edge;
+
+    if (d < 2) {
+        for (k = 0; k < np; k++) {
+            if (to_grid) old[line][k+1] = buf[k];
+            else buf[k] = old[line][k+1];
+        }
+    } else {
+        for (k = 0; k < mp; k++) {
+            if (to_grid) old[k+1][line] = buf[k];
+            else buf[k] = old[k+1][line];
         }
     }
+}
+
+/**
+ * @brief The number of values in a halo swapped way d
+ * @param d the way
+ * @return the length of the halo
+ */
+static int async_length (int d) {
+    return d < 2 ? async.img_dim.np : async.img_dim.mp;
+}
+
+/**
+ * @brief Post the receive of the next halo from way d
+ * @param d the way
+ */
+static void async_receive (int d) {
+    MPI_Irecv(async.recv[d], async_length(d), MPI_REALNUM, async.neighbour[d], ASYNC_TAG + (d^1),
+        async.cart_comm, &(async.requests[4+d]));
+}
 
-    /* wait for halo swap, hopefully completed by now */
-    MPI_Waitall(8, requests, statuses);
+/**
+ * @brief Start swapping halos without waiting, see ::update_async and ::async_finish
+ * @param cart_comm the cartesian communicator for the processes
+ * @param img_dim the dimensions of the local and global data
+ */
+void async_start (MPI_Comm cart_comm, image_dimensions img_dim) {
+    int d;
 
-    /* reconstruct pixels that depend on halos */
-    for (j = 1; j < (img_dim.np + 1); j++) {
-        new[1][j] = 0.25 * (old[1][j-1] + old[1][j+1] + old[0][j] + old[2][j] - edge[1][j]);
-        new[img_dim.mp][j] = 0.25 * (old[img_dim.mp][j-1] + old[img_dim.mp][j+1] + old[img_dim.mp-1][j] + old[img_dim.mp+1][j] - edge[img_dim.mp][j]);
+    async.cart_comm = cart_comm;
+    async.img_dim = img_dim;
+    MPI_Cart_shift(cart_comm, 0, 1, &(async.neighbour[0]), &(async.neighbour[1]));
+    MPI_Cart_shift(cart_comm, 1, 1, &(async.neighbour[2]), &(async.neighbour[3]));
+
+    for (d = 0; d < 4; d++) {
+        async.send[d] = (real *) malloc(async_length(d) * sizeof(real));
+        async.recv[d] = (real *) malloc(async_length(d) * sizeof(real));
+        async.requests[d] = MPI_REQUEST_NULL;
+        async.requests[4+d] = MPI_REQUEST_NULL;
+        async.sent[d] = 0;
+        async.received[d] = 0;
+        /* there is nothing to receive past the top and bottom of the image */
+        if (async.neighbour[d] != MPI_PROC_NULL) async_receive(d);
+    }
+}
+
+/**
+ * @brief Performs one reconstruct operation without waiting for the neighbours. The
+ *        newest halos that have arrived are used, and the new edges are sent each way the
+ *        last send has completed, so a slow neighbour never holds this process up.
+ *        Swaps must have been started with ::async_start.
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param img_dim the dimensions of the local and global data
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data
+ * @param new stores the current operation's data
+ * @return both the maximum pixel change and the the average pixel value. See ::step_return
+ */
+step_return update_async (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new){
+    int i, j, d, done;
+    real delta = 0.0;
+    step_return retval = {0.0};
+    double t = trace_begin();
+
+    /* take the newest halo from each way, halos from one process arrive in order */
+    for (d = 0; d < 4; d++) {
+        if (async.neighbour[d] == MPI_PROC_NULL) continue;
+        MPI_Test(&(async.requests[4+d]), &done, MPI_STATUS_IGNORE);
+        while (done) {
+            async_copy(old, d, async.recv[d], 1);
+            async.received[d]++;
+            async_receive(d);
+            MPI_Test(&(async.requests[4+d]), &done, MPI_STATUS_IGNORE);
+        }
     }
+    trace_end("halo poll", t);
 
+    t = trace_begin();
+    counters_start();
     for (i = 1; i < (img_dim.mp + 1); i++) {
-        new[i][1] = 0.25 * (old[i][0] + old[i][2] + old[i-1][1] + old[i+1][1] - edge[i][1]);
-        new[i][img_dim.np] = 0.25 * (old[i][img_dim.np-1] + old[i][img_dim.np+1] + old[i-1][img_dim.np] + old[i+1][img_dim.np] - edge[i][img_dim.np]);
+        for (j = 1; j < (img_dim.np + 1); j++) {
+            new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+        }
     }
+    counters_stop(COUNTERS_STENCIL, img_dim.mp*img_dim.np);
 
-    /* set old = new for next iteration, while finding the max delta value */
+    counters_start();
     for (i = 1; i < (img_dim.mp + 1); i++) {
         for (j = 1; j < (img_dim.np + 1); j++) {
             delta = fabs(new[i][j] - old[i][j]);
             if (delta > retval.delta) {
                 retval.delta = delta;
             }
-            retval.sum += new[i][j];
+            if (repro_wanted & REPRO_SUM) repro_add(&(retval.sum), new[i][j]);
+            if (repro_wanted & REPRO_SQUARE) repro_add(&(retval.square), delta*delta);
             old[i][j] = new[i][j];
         }
     }
+    counters_stop(COUNTERS_COPY, img_dim.mp*img_dim.np);
+    trace_end("interior", t);
+
+    /* a send still in flight keeps its buffer, the next operation sends a newer edge */
+    t = trace_begin();
+    for (d = 0; d < 4; d++) {
+        if (async.neighbour[d] == MPI_PROC_NULL) continue;
+        MPI_Test(&(async.requests[d]), &done, MPI_STATUS_IGNORE);
+        if (!done) continue;
+        async_copy(old, d, async.send[d], 0);
+        MPI_Isend(async.send[d], async_length(d), MPI_REALNUM, async.neighbour[d], ASYNC_TAG + d,
+            cart_comm, &(async.requests[d]));
+        async.sent[d]++;
+    }
+    trace_end("halo post", t);
+
     return retval;
 }
+
+/**
+ * @brief Stop swapping halos without waiting. Each process tells its neighbours how many
+ *        halos it sent, and receives the rest of theirs, so no message is left behind.
+ * @param old the grid, which gets the last halo from each way
+ */
+void async_finish (real ** old) {
+    int d, expected[4];
+    MPI_Request counts[8];
+    double t = trace_begin();
+
+    for (d = 0; d < 4; d++) {
+        expected[d] = 0;
+        MPI_Irecv(&(expected[d]), 1, MPI_INT, async.neighbour[d], ASYNC_TAG + 4 + (d^1), async.cart_comm, &(counts[4+d]));
+        MPI_Isend(&(async.sent[d]), 1, MPI_INT, async.neighbour[d], ASYNC_TAG + 4 + d, async.cart_comm, &(counts[d]));
+    }
+    MPI_Waitall(8, counts, MPI_STATUSES_IGNORE);
+
+    for (d = 0; d < 4; d++) {
+        if (async.neighbour[d] == MPI_PROC_NULL) continue;
+        while (async.received[d] < expected[d]) {
+            MPI_Wait(&(async.requests[4+d]), MPI_STATUS_IGNORE);
+            async_copy(old, d, async.recv[d], 1);
+            async.received[d]++;
+            if (async.received[d] < expected[d]) async_receive(d);
+        }
+        /* the receive posted for a halo that was never sent */
+        if (async.requests[4+d] != MPI_REQUEST_NULL) {
+            MPI_Cancel(&(async.requests[4+d]));
+            MPI_Wait(&(async.requests[4+d]), MPI_STATUS_IGNORE);
+        }
+    }
+    MPI_Waitall(4, async.requests, MPI_STATUSES_IGNORE);
+
+    for (d = 0; d < 4; d++) {
+        free(async.send[d]);
+        free(async.recv[d]);
+    }
+    trace_end("halo drain", t);
+}
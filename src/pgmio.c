@@ -16,6 +16,38 @@
  *    int nx, ny;
  *    pgmsize("edge.pgm", &nx, &ny);
  *
+ * "pgmreadedge" and "pgmwritegrey" do the same for grids of the compact
+ * types in precision.h, where the picture has already been scaled to 0..255:
+ *
+ *    edgenum **ebuf = grid_alloc(sizeof(edgenum), M, N);
+ *    greynum **gbuf = grid_alloc(sizeof(greynum), M, N);
+ *    pgmreadedge("edge.pgm", ebuf, M, N);
+ *    pgmwritegrey("picture.pgm", gbuf, M, N);
+ *
+ * "pgmreadedgefp" reads the next of several pictures from an open file,
+ * in to an array in the order of the file:
+ *
+ *    edgenum frame[N*M];
+ *    while (pgmreadedgefp(fp, frame, M, N)) ...
+ *
+ * Pictures too large for memory can be read and written a row at a time,
+ * from the top, in the same format as above:
+ *
+ *    FILE *in = pgmreadedgestart("edge.pgm", M, N);
+ *    FILE *out = pgmwritegreystart("picture.pgm", M, N);
+ *    int k = 0;
+ *    for (j = 0; j < N; j++) {
+ *      pgmreadedgerow(in, erow, M);
+ *      ...
+ *      pgmwritegreyrow(out, grow, M, &k);
+ *    }
+ *    fclose(in);
+ *    pgmwritegreyend(out, k);
+ *
+ * "pgmsizecheck", "pgmreadedgecheck" and "pgmwritegreycheck" return -1
+ * instead of exiting when the file cannot be opened, is malformed, is the
+ * wrong size or is truncated, for programs that must outlive a bad file.
+ *
  *  To access these routines, add the following to your program:
  *
  *    #include "pgmio.h"
@@ -26,7 +58,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <limits.h>
 
 #include <precision.h>
 
@@ -124,6 +158,276 @@ void pgmread(char *filename, void *vx, int nx, int ny)
 }
 
 
+/*
+ *  Routine to parse a PGM header from an open file, allowing any
+ *  number of comment lines after "P2", and return its size.
+ *
+ *  Returns 1 if a header was read, 0 at the end of the file, or -1
+ *  if the header is not valid.
+ */
+
+static int pgmparseheader(FILE *fp, const char *caller, int *nx, int *ny)
+{
+  int max, c;
+  char magic[3];
+
+  int iret;
+
+  if (1 != fscanf(fp," %2s", magic)) return 0;
+
+  if (strcmp(magic, "P2") != 0)
+  {
+    fprintf(stderr, "%s: expected P2, found <%s>\n", caller, magic);
+    return -1;
+  }
+
+  /* skip comment lines */
+  iret = fscanf(fp," ");
+  while ((c = getc(fp)) == '#')
+  {
+    while ((c = getc(fp)) != '\n' && c != EOF);
+    iret = fscanf(fp," ");
+  }
+  ungetc(c, fp);
+
+  if (2 != fscanf(fp,"%d %d", nx, ny) || 1 != fscanf(fp,"%d",&max)
+      || *nx < 1 || *ny < 1)
+  {
+    fprintf(stderr, "%s: malformed header\n", caller);
+    return -1;
+  }
+
+  return 1;
+}
+
+
+/*
+ *  Routine to read a PGM header from an open file and check the size.
+ *
+ *  Returns 1 if a header was read, 0 at the end of the file, or -1
+ *  if the header is not valid or the size does not match.
+ */
+
+static int pgmcheckheader(FILE *fp, const char *caller, int nx, int ny)
+{
+  int nxt, nyt, found;
+
+  if (1 != (found = pgmparseheader(fp, caller, &nxt, &nyt))) return found;
+
+  if (nx != nxt || ny != nyt)
+  {
+    fprintf(stderr,
+            "%s: size mismatch, (nx,ny) = (%d,%d) expected (%d,%d)\n",
+            caller, nxt, nyt, nx, ny);
+    return -1;
+  }
+
+  return 1;
+}
+
+
+/*
+ *  As pgmcheckheader, but exits if the header is not valid.
+ */
+
+static int pgmreadheader(FILE *fp, const char *caller, int nx, int ny)
+{
+  int found;
+
+  if (-1 == (found = pgmcheckheader(fp, caller, nx, ny))) exit(-1);
+
+  return found;
+}
+
+
+/*
+ *  Routine to parse one value of a PGM image, which must fit in an
+ *  edgenum.
+ *
+ *  Returns 0, or -1 if the file ends or the value does not fit.
+ */
+
+static int pgmparseedgeval(FILE *fp, const char *caller, edgenum *x)
+{
+  int t;
+
+  if (1 != fscanf(fp,"%d", &t))
+  {
+    fprintf(stderr, "%s: image is truncated\n", caller);
+    return -1;
+  }
+
+  if (t < SHRT_MIN || t > SHRT_MAX)
+  {
+    fprintf(stderr, "%s: value %d does not fit an edgenum\n", caller, t);
+    return -1;
+  }
+
+  *x = (edgenum) t;
+  return 0;
+}
+
+
+/*
+ *  As pgmparseedgeval, but exits if the value cannot be read.
+ */
+
+static edgenum pgmreadedgeval(FILE *fp, const char *caller)
+{
+  edgenum x;
+
+  if (0 != pgmparseedgeval(fp, caller, &x)) exit(-1);
+
+  return x;
+}
+
+
+/*
+ *  Routine to read the next PGM image from an open file into an
+ *  edgenum array x[ny*nx], in the order of the file: x[j*nx+i] is
+ *  pixel i of row j, counting from the top. Files may hold several
+ *  images one after another. The values must fit in an edgenum.
+ *
+ *  Returns 1 if an image was read, or 0 at the end of the file.
+ */
+
+int pgmreadedgefp(FILE *fp, edgenum *x, int nx, int ny)
+{
+  int i;
+
+  if (!pgmreadheader(fp, "pgmreadedgefp", nx, ny)) return 0;
+
+  for (i=0; i<nx*ny; i++)
+  {
+    x[i] = pgmreadedgeval(fp, "pgmreadedgefp");
+  }
+
+  return 1;
+}
+
+
+/*
+ *  Routine to open a PGM data file and read its header, so the rows
+ *  can be read one at a time from the top with pgmreadedgerow.
+ */
+
+FILE *pgmreadedgestart(char *filename, int nx, int ny)
+{
+  FILE *fp;
+
+  if (NULL == (fp = fopen(filename,"r")))
+  {
+    fprintf(stderr, "pgmreadedgestart: cannot open <%s>\n", filename);
+    exit(-1);
+  }
+
+  if (!pgmreadheader(fp, "pgmreadedgestart", nx, ny))
+  {
+    fprintf(stderr, "pgmreadedgestart: no image in <%s>\n", filename);
+    exit(-1);
+  }
+
+  return fp;
+}
+
+
+/*
+ *  Routine to read the next row of nx values from a file opened with
+ *  pgmreadedgestart. The values must fit in an edgenum.
+ */
+
+void pgmreadedgerow(FILE *fp, edgenum *row, int nx)
+{
+  int i;
+
+  for (i=0; i<nx; i++)
+  {
+    row[i] = pgmreadedgeval(fp, "pgmreadedgerow");
+  }
+}
+
+
+/*
+ *  Routine to check the header of a PGM data file and get its size,
+ *  allowing any number of comment lines.
+ *
+ *  Returns 0, or -1 if the file cannot be opened or has no valid header.
+ */
+
+int pgmsizecheck(char *filename, int *nx, int *ny)
+{
+  FILE *fp;
+  int found;
+
+  if (NULL == (fp = fopen(filename,"r")))
+  {
+    fprintf(stderr, "pgmsizecheck: cannot open <%s>\n", filename);
+    return -1;
+  }
+
+  if (0 == (found = pgmparseheader(fp, "pgmsizecheck", nx, ny)))
+  {
+    fprintf(stderr, "pgmsizecheck: no image in <%s>\n", filename);
+  }
+
+  fclose(fp);
+  return found == 1 ? 0 : -1;
+}
+
+
+/*
+ *  Routine to read a PGM data file into a 2D edgenum grid x[nx][ny].
+ *  The values must fit in an edgenum.
+ *
+ *  Returns 0, or -1 if the file cannot be opened, is the wrong size,
+ *  is truncated or holds a value that does not fit.
+ */
+
+int pgmreadedgecheck(char *filename, edgenum **x, int nx, int ny)
+{
+  FILE *fp;
+  int i, j;
+
+  if (NULL == (fp = fopen(filename,"r")))
+  {
+    fprintf(stderr, "pgmreadedge: cannot open <%s>\n", filename);
+    return -1;
+  }
+
+  if (1 != pgmcheckheader(fp, "pgmreadedge", nx, ny))
+  {
+    fprintf(stderr, "pgmreadedge: no image of the expected size in <%s>\n", filename);
+    fclose(fp);
+    return -1;
+  }
+
+  for (j=0; j<ny; j++)
+  {
+    for (i=0; i<nx; i++)
+    {
+      if (0 != pgmparseedgeval(fp, "pgmreadedge", &x[i][ny-j-1]))
+      {
+        fclose(fp);
+        return -1;
+      }
+    }
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+
+/*
+ *  As pgmreadedgecheck, but exits if the file cannot be read.
+ */
+
+void pgmreadedge(char *filename, edgenum **x, int nx, int ny)
+{
+  if (0 != pgmreadedgecheck(filename, x, nx, ny)) exit(-1);
+}
+
+
 /*
  *  Routine to write a PGM image file from a 2D floating point array
  *  x[nx][ny]. Because of the way C handles (or fails to handle!)
@@ -199,3 +503,123 @@ void pgmwrite(char *filename, void *vx, int nx, int ny)
   if (0 != k%16) fprintf(fp, "\n");
   fclose(fp);
 }
+
+
+/*
+ *  Routine to write a PGM image file from a 2D greynum grid x[nx][ny]
+ *  that has already been scaled to lie between 0 and 255.
+ *
+ *  Returns 0, or -1 if the file cannot be created or written.
+ */
+
+int pgmwritegreycheck(char *filename, greynum **x, int nx, int ny)
+{
+  FILE *fp;
+
+  int i, j, k;
+
+  if (NULL == (fp = fopen(filename,"w")))
+  {
+    fprintf(stderr, "pgmwritegrey: cannot create <%s>\n", filename);
+    return -1;
+  }
+
+  printf("Writing %d x %d picture into file: %s\n", nx, ny, filename);
+
+  fprintf(fp, "P2\n");
+  fprintf(fp, "# Written by pgmio::pgmwrite\n");
+  fprintf(fp, "%d %d\n", nx, ny);
+  fprintf(fp, "%d\n", 255);
+
+  k = 0;
+
+  for (j=ny-1; j >=0 ; j--)
+  {
+    for (i=0; i < nx; i++)
+    {
+      fprintf(fp, "%3d ", (int) x[i][j]);
+
+      if (0 == (k+1)%16) fprintf(fp, "\n");
+
+      k++;
+    }
+  }
+
+  if (0 != k%16) fprintf(fp, "\n");
+
+  if (ferror(fp) | fclose(fp))
+  {
+    fprintf(stderr, "pgmwritegrey: cannot write <%s>\n", filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ *  As pgmwritegreycheck, but exits if the file cannot be written.
+ */
+
+void pgmwritegrey(char *filename, greynum **x, int nx, int ny)
+{
+  if (0 != pgmwritegreycheck(filename, x, nx, ny)) exit(-1);
+}
+
+
+/*
+ *  Routine to create a PGM image file and write its header, so rows
+ *  that have already been scaled to lie between 0 and 255 can be
+ *  written one at a time from the top with pgmwritegreyrow.
+ */
+
+FILE *pgmwritegreystart(char *filename, int nx, int ny)
+{
+  FILE *fp;
+
+  if (NULL == (fp = fopen(filename,"w")))
+  {
+    fprintf(stderr, "pgmwritegreystart: cannot create <%s>\n", filename);
+    exit(-1);
+  }
+
+  printf("Writing %d x %d picture into file: %s\n", nx, ny, filename);
+
+  fprintf(fp, "P2\n");
+  fprintf(fp, "# Written by pgmio::pgmwrite\n");
+  fprintf(fp, "%d %d\n", nx, ny);
+  fprintf(fp, "%d\n", 255);
+
+  return fp;
+}
+
+
+/*
+ *  Routine to write the next row of nx values to a file created with
+ *  pgmwritegreystart. k counts the values written so far, start it at 0.
+ */
+
+void pgmwritegreyrow(FILE *fp, greynum *row, int nx, int *k)
+{
+  int i;
+
+  for (i=0; i < nx; i++)
+  {
+    fprintf(fp, "%3d ", (int) row[i]);
+
+    if (0 == (*k+1)%16) fprintf(fp, "\n");
+
+    (*k)++;
+  }
+}
+
+
+/*
+ *  Routine to finish a file written with pgmwritegreyrow.
+ */
+
+void pgmwritegreyend(FILE *fp, int k)
+{
+  if (0 != k%16) fprintf(fp, "\n");
+  fclose(fp);
+}
@@ -0,0 +1,868 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file reconstruct.c
+ * @author James Clark
+ * @brief The libreconstruct API, a reconstruction that can be reused for many images.
+ *
+ * A context holds the cartesian communicator and every grid for one image size, so
+ * images of that size can be loaded and solved one after another without setting them
+ * up again. All functions other than ::reconstruct_default_options are collective over
+ * the communicator the context was created on. Images are passed in the order of a PGM
+ * file, element j*m+i being pixel i of row j counting from the top, and only rank 0's
+ * buffers are used. MPI must be initialised by the caller.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <mpi.h>
+
+#include <grid.h>
+#include <precision.h>
+#include <functions.h>
+#include <metrics.h>
+
+/* Default options */
+/** Default maximum number of iterations */
+#define MAX_COUNT 5000
+/** Default output interval */
+#define STEP 100
+/** Default minimum delta value */
+#define MIN_DELTA 0.1
+/** Default operations per wavefront block, 1 disables the wavefront */
+#define TILE_DEPTH 1
+/** Default active block size, 0 disables active blocks */
+#define ACTIVE_BLOCK 0
+/** Default number of warm start levels, 0 starts from white */
+#define WARM_START 0
+/** Default and largest active block threshold, as a fraction of the minimum delta */
+#define ACTIVE_FRACTION 0.01
+/** Default iterations between checks of the global delta */
+#define CHECK_INTERVAL 1
+/** Default rows of the interior swept between tests of the halo swap */
+#define POLL_ROWS 16
+/** Default snapshot file name pattern */
+#define SNAPSHOT_OUTPUT "snapshot%06d.pgm"
+/** Iterations the convergence rate is measured over */
+#define RATE_WINDOW 50
+/** Default imbalance that repartitions the image */
+#define BALANCE_THRESHOLD 0.1
+
+struct reconstruct_context {
+    MPI_Comm cart_comm;        /**< The cartesian communicator for the processes */
+    int rank;                  /**< The rank of this process in cart_comm */
+    int size;                  /**< The number of processes in cart_comm */
+    int dims[2];               /**< The number of processes in each dimension */
+    image_dimensions img_dim;  /**< The dimensions of the local and global data */
+    edgenum ** main_buf;       /**< The global edge data, only on rank 0 */
+    greynum ** grey_buf;       /**< The global grey levels, only on rank 0 */
+    edgenum ** edge;           /**< The local edge data */
+    real ** old;               /**< The local image */
+    real ** new;               /**< The local image being computed, NULL until a solve that is not in place */
+    real ** save;              /**< A copy of old for replaying wavefront blocks, NULL until needed */
+    greynum ** grey;           /**< The local grey levels */
+    step_return * results;     /**< The ::step_return of each operation in a block */
+    int tile_depth;            /**< The number of results there is room for */
+    int solved;                /**< Whether old holds the result of a solve */
+    int * cuts;                /**< Where the tiles start in each dim, see ::balance_cuts, NULL while split evenly */
+    update_state * state;      /**< What the updates keep between solves, such as the persistent halo swap */
+};
+
+/**
+ * @brief Set the default options
+ * @param options the options to set
+ */
+void reconstruct_default_options (reconstruct_options * options) {
+    options->iterations = MAX_COUNT;
+    options->delta = MIN_DELTA;
+    options->step = STEP;
+    options->tile_depth = TILE_DEPTH;
+    options->active_block = ACTIVE_BLOCK;
+    options->active_threshold = -1.0;
+    options->warm_start = WARM_START;
+    options->keep_guess = 0;
+    options->check_interval = CHECK_INTERVAL;
+    options->stop = RECONSTRUCT_STOP_DELTA;
+    options->snapshot_every = 0;
+    options->snapshot = SNAPSHOT_OUTPUT;
+    options->async = 0;
+    options->poll_rows = POLL_ROWS;
+    options->halo_float = 0;
+    options->balance = 0;
+    options->balance_threshold = BALANCE_THRESHOLD;
+    options->in_place = 0;
+}
+
+/**
+ * @brief Create a context for m x n images, shared by the processes of a communicator
+ * @param comm the communicator of the processes to use, it is not modified
+ * @param m the width of the images
+ * @param n the height of the images
+ * @return the context, or NULL on every process if the image cannot be split evenly
+ */
+reconstruct_context * reconstruct_create (MPI_Comm comm, int m, int n) {
+    int dims[2] = {0,0};
+
+    return reconstruct_create_grid(comm, m, n, dims);
+}
+
+/**
+ * @brief Create a context for m x n images, with the processes laid out in a given grid
+ * @param comm the communicator of the processes to use, it is not modified
+ * @param m the width of the images
+ * @param n the height of the images
+ * @param dims the number of processes across and down the image, 0 to let MPI decide
+ * @return the context, or NULL on every process if the processes cannot be laid out
+ *         that way or the image cannot be split evenly
+ */
+reconstruct_context * reconstruct_create_grid (MPI_Comm comm, int m, int n, const int * dims) {
+    reconstruct_context * context = (reconstruct_context *) malloc(sizeof(reconstruct_context));
+    image_dimensions * img_dim = &(context->img_dim);
+
+    context->dims[0] = dims[0];
+    context->dims[1] = dims[1];
+    if (get_cart_comm(comm, &(context->rank), &(context->size), context->dims, &(context->cart_comm)) != 0) {
+        free(context);
+        return NULL;
+    }
+
+    if ((m % context->dims[0] != 0) || (n % context->dims[1] != 0)) {
+        free_cart_comm(&(context->cart_comm));
+        free(context);
+        return NULL;
+    }
+
+    img_dim->m = m;
+    img_dim->n = n;
+    img_dim->mp = m/context->dims[0];
+    img_dim->np = n/context->dims[1];
+    img_dim->cuts[0] = NULL;
+    img_dim->cuts[1] = NULL;
+
+    context->main_buf = NULL;
+    context->grey_buf = NULL;
+    if (context->rank == 0) {
+        /* Only rank 0 needs to allocate the main buffers */
+        context->main_buf = (edgenum **) grid_alloc(sizeof(edgenum), img_dim->m, img_dim->n);
+        context->grey_buf = (greynum **) grid_alloc(sizeof(greynum), img_dim->m, img_dim->n);
+    }
+    context->edge = (edgenum **) grid_alloc(sizeof(edgenum), img_dim->mp+2, img_dim->np+2);
+    context->old  = (real **) grid_alloc(sizeof(real), img_dim->mp+2, img_dim->np+2);
+    /* made by the first solve that is not in place */
+    context->new  = NULL;
+    context->grey = (greynum **) grid_alloc(sizeof(greynum), img_dim->mp+2, img_dim->np+2);
+    context->save = NULL;
+    context->results = NULL;
+    context->tile_depth = 0;
+    context->solved = 0;
+    context->cuts = NULL;
+    context->state = update_state_create();
+
+    return context;
+}
+
+/**
+ * @brief Free a context
+ * @param context the context to free
+ */
+void reconstruct_destroy (reconstruct_context * context) {
+    grid_free(context->main_buf);
+    grid_free(context->grey_buf);
+    grid_free(context->edge);
+    grid_free(context->old);
+    grid_free(context->new);
+    grid_free(context->save);
+    grid_free(context->grey);
+    free(context->results);
+    free(context->cuts);
+    /* the halo swap holds requests on the communicator */
+    update_state_free(context->state);
+    free_cart_comm(&(context->cart_comm));
+    free(context);
+}
+
+/**
+ * @brief Get the layout of the processes in a context
+ * @param context the context
+ * @param rank stores the rank of the calling process, 0 is the one that reads and writes images
+ * @param dims stores the number of processes in each dimension
+ */
+void reconstruct_topology (reconstruct_context * context, int * rank, int * dims) {
+    *rank = context->rank;
+    dims[0] = context->dims[0];
+    dims[1] = context->dims[1];
+}
+
+/**
+ * @brief Load an image's edge data from memory
+ * @param context the context
+ * @param edge the m x n edge data, only used on rank 0
+ */
+void reconstruct_load (reconstruct_context * context, const edgenum * edge) {
+    int i, j;
+    image_dimensions img_dim = context->img_dim;
+
+    /* the grids hold columns, from the bottom of the image */
+    if (context->rank == 0) {
+        for (j = 0; j < img_dim.n; j++) {
+            for (i = 0; i < img_dim.m; i++) {
+                context->main_buf[i][img_dim.n-j-1] = edge[j*img_dim.m + i];
+            }
+        }
+    }
+    scatter_data(context->cart_comm, context->rank, context->size, img_dim, context->edge, context->main_buf);
+}
+
+/**
+ * @brief Load an image's edge data from a PGM file
+ * @param context the context
+ * @param filename the file to read, only used on rank 0
+ * @return 0, or -1 on every process if rank 0 could not read the file, leaving the last image loaded
+ */
+int reconstruct_load_file (reconstruct_context * context, char * filename) {
+    int status;
+
+    status = image_read(context->rank, filename, context->img_dim, context->main_buf);
+    /* only rank 0 knows if the file was read */
+    broadcast(context->cart_comm, &status, sizeof(status));
+    if (status != 0) return -1;
+
+    scatter_data(context->cart_comm, context->rank, context->size, context->img_dim, context->edge, context->main_buf);
+    return 0;
+}
+
+/** Tracks how fast a solve is converging, see ::solve_measure */
+typedef struct {
+    int iteration;  /**< The iteration the reference norm was taken at, -1 before the first */
+    real norm;      /**< The reference norm */
+    real rate;      /**< The estimated factor the error shrinks by each iteration, 1 until known */
+} convergence;
+
+/**
+ * @brief Reduce the norm of the changes made by an iteration and find the stop measure.
+ *
+ * The residual of the image before an iteration is exactly 4 times the change the
+ * iteration makes, so the residual norms come from the sweep for free. The ratio of the
+ * norms RATE_WINDOW iterations apart estimates the convergence rate r, once the faster
+ * modes have died away, and the error is then bounded by the change times r/(1-r).
+ * @param cart_comm the cartesian communicator for the processes
+ * @param img_dim the dimensions of the local and global data
+ * @param stop the stop measure, see ::reconstruct_stop
+ * @param local what this process's part of the iteration did
+ * @param iteration the iteration
+ * @param conv the convergence rate estimate to update
+ * @param global_delta stores the global delta, if the stop measure needs it
+ * @return the stop measure
+ */
+static real solve_measure (MPI_Comm cart_comm, image_dimensions img_dim, int stop, step_return * local,
+                           int iteration, convergence * conv, real * global_delta) {
+    real norm, global_square;
+
+    if (stop == RECONSTRUCT_STOP_DELTA || stop == RECONSTRUCT_STOP_RESIDUAL_MAX) {
+        reduce(cart_comm, MPI_MAX, &(local->delta), global_delta);
+        norm = *global_delta;
+    } else {
+        reduce_repro(cart_comm, &(local->square), &global_square);
+        norm = sqrt(global_square / ((real) img_dim.m * img_dim.n));
+    }
+
+    if (conv->iteration < 0) {
+        conv->iteration = iteration;
+        conv->norm = norm;
+    } else if (iteration - conv->iteration >= RATE_WINDOW) {
+        if (norm > 0.0 && conv->norm > 0.0)
+            conv->rate = pow(norm / conv->norm, 1.0 / (iteration - conv->iteration));
+        conv->iteration = iteration;
+        conv->norm = norm;
+    }
+
+    switch (stop) {
+        case RECONSTRUCT_STOP_RESIDUAL_MAX:
+        case RECONSTRUCT_STOP_RESIDUAL_L2:
+            return 4.0 * norm;
+        case RECONSTRUCT_STOP_ERROR:
+            return conv->rate < 1.0 ? norm * conv->rate / (1.0 - conv->rate) : FLT_MAX;
+        default:
+            return norm;
+    }
+}
+
+/**
+ * @brief Choose the sums the next block of iterations has to add up, see ::repro_wanted
+ * @param options the options for the solve
+ * @param iteration the first iteration of the block
+ * @param steps the number of iterations in the block
+ * @return REPRO_SUM if an iteration of the block prints the average, and REPRO_SQUARE if
+ *         the stop measure needs the squared deltas
+ */
+static int solve_wanted (const reconstruct_options * options, int iteration, int steps) {
+    int s, i, squares, wanted = 0;
+
+    /* every iteration with active blocks, as skipped blocks give their last squares */
+    squares = options->stop == RECONSTRUCT_STOP_RESIDUAL_L2 || options->stop == RECONSTRUCT_STOP_ERROR;
+    if (squares && options->active_block > 0) wanted |= REPRO_SQUARE;
+    for (s = 0; s < steps; s++) {
+        i = iteration + s;
+        if (options->step > 0 && i % options->step == 0) wanted |= REPRO_SUM | (squares ? REPRO_SQUARE : 0);
+        /* the iterations that check the stop measure, see ::reconstruct_solve */
+        if (squares && ((i + 1) % options->check_interval == 0 || i + 1 == options->iterations))
+            wanted |= REPRO_SQUARE;
+    }
+    return wanted;
+}
+
+/**
+ * @brief Predict the iterations left until the stop measure reaches the target
+ * @param measure the stop measure
+ * @param target the target
+ * @param rate the factor the measure shrinks by each iteration
+ * @return the iterations left, 0 if converged, or -1 if the rate is not known
+ */
+static int solve_remaining (real measure, real target, real rate) {
+    if (measure <= target) return 0;
+    if (rate <= 0.0 || rate >= 1.0) return -1;
+    return (int) ceil(log(target / measure) / log(rate));
+}
+
+/**
+ * @brief Publish the progress of the solve, see metrics.c. Only values rank 0 already has
+ *        are published, so this never adds a reduction
+ * @param iteration the iterations done
+ * @param delta the last global delta reduced
+ * @param measure the last stop measure
+ * @param rate the factor the measure shrinks by each iteration
+ * @param target the stop measure to reach
+ * @param phase the seconds spent in the updates, halo waits included, and in reductions
+ */
+static void solve_publish (int iteration, real delta, real measure, real rate, real target, const double * phase) {
+    double seconds[METRICS_PHASES];
+
+    seconds[METRICS_HALO] = halo_waited();
+    seconds[METRICS_COMPUTE] = phase[METRICS_COMPUTE] - seconds[METRICS_HALO];
+    seconds[METRICS_REDUCE] = phase[METRICS_REDUCE];
+    metrics_publish(iteration, delta, measure, rate, solve_remaining(measure, target, rate), seconds);
+}
+
+/** One process's speed, gathered by ::solve_balance */
+typedef struct {
+    int coords[2];  /**< The coordinates of the process */
+    real busy;      /**< Seconds spent updating its tile, less waiting for halos */
+    real pixels;    /**< Pixels updated in that time */
+} balance_sample;
+
+/**
+ * @brief Move the image to a new partition, see balance.c. The edge data and the image
+ *        are moved between the processes whose tiles overlap, and the other grids and the
+ *        halo swap are made again for the new tile size.
+ * @param context the context
+ * @param cuts where the tiles start in each dim, see ::balance_cuts, kept by the context
+ */
+static void solve_partition (reconstruct_context * context, int * cuts) {
+    image_dimensions from = context->img_dim, to = context->img_dim;
+    int coords[2], offset[2], length[2];
+    edgenum ** edge;
+    real ** old;
+
+    to.cuts[0] = cuts;
+    to.cuts[1] = cuts + context->dims[0] + 1;
+    tile_extent(context->cart_comm, context->rank, to, coords, offset, length);
+    to.mp = length[0];
+    to.np = length[1];
+
+    edge = (edgenum **) grid_alloc(sizeof(edgenum), to.mp+2, to.np+2);
+    old  = (real **) grid_alloc(sizeof(real), to.mp+2, to.np+2);
+    migrate_tile(context->cart_comm, context->rank, context->size, from, to, MPI_EDGENUM, context->edge, edge);
+    migrate_tile(context->cart_comm, context->rank, context->size, from, to, MPI_REALNUM, context->old, old);
+    /* the other halos are filled by the next swap */
+    sawtooth(context->cart_comm, context->rank, to, old);
+
+    /* the persistent swap points in to the old grid */
+    halo_release(context->state);
+    grid_free(context->edge);
+    grid_free(context->old);
+    grid_free(context->grey);
+    context->edge = edge;
+    context->old  = old;
+    context->grey = (greynum **) grid_alloc(sizeof(greynum), to.mp+2, to.np+2);
+    if (context->new != NULL) {
+        grid_free(context->new);
+        context->new = (real **) grid_alloc(sizeof(real), to.mp+2, to.np+2);
+    }
+
+    free(context->cuts);
+    context->cuts = cuts;
+    context->img_dim = to;
+}
+
+/**
+ * @brief Measure how evenly the processes share the work, and repartition the image in
+ *        proportion to their speeds if it is too uneven. See balance.c
+ * @param context the context
+ * @param options the options for the solve
+ * @param iteration the iteration, for printing
+ * @param busy the seconds this process spent updating its tile since the last call, less
+ *        waiting for halos
+ * @param iterations the iterations since the last call
+ * @param imbalance stores how much slower than the mean the slowest process was, on rank 0
+ * @return 1 if the image was repartitioned, otherwise 0
+ */
+static int solve_balance (reconstruct_context * context, const reconstruct_options * options, int iteration,
+                          double busy, int iterations, real * imbalance) {
+    int r, k, offset[2], length[2], counts[context->size];
+    int parts = context->dims[0] + context->dims[1] + 2;
+    int cuts[parts+1], coords[2*context->size];
+    int * kept;
+    real slowest = 0.0, mean = 0.0, speed[context->size];
+    balance_sample local, * all;
+
+    tile_extent(context->cart_comm, context->rank, context->img_dim, local.coords, offset, length);
+    local.busy = busy;
+    local.pixels = (real) length[0] * length[1] * iterations;
+    all = (balance_sample *) gather_bytes(context->cart_comm, context->rank, context->size, &local, sizeof(balance_sample), counts);
+
+    /* the last value says whether to repartition */
+    cuts[parts] = 0;
+    if (context->rank == 0) {
+        for (r = 0; r < context->size; r++) {
+            mean += all[r].busy / context->size;
+            if (all[r].busy > slowest) slowest = all[r].busy;
+        }
+        *imbalance = mean > 0.0 ? slowest/mean - 1.0 : 0.0;
+
+        if (*imbalance > options->balance_threshold) {
+            for (r = 0; r < context->size; r++) {
+                speed[r] = all[r].busy > 0.0 ? all[r].pixels / all[r].busy : 0.0;
+                coords[2*r] = all[r].coords[0];
+                coords[2*r+1] = all[r].coords[1];
+            }
+            if (balance_cuts(context->dims, context->img_dim.m, context->img_dim.n, context->size, coords, speed, cuts) == 0) {
+                /* the measurements may only confirm the partition there is */
+                for (k = 0; k < parts; k++) {
+                    if (context->cuts != NULL ? cuts[k] != context->cuts[k]
+                        : cuts[k] != (k <= context->dims[0] ? k * context->img_dim.mp : (k - context->dims[0] - 1) * context->img_dim.np))
+                        cuts[parts] = 1;
+                }
+            }
+        }
+        free(all);
+    }
+    broadcast(context->cart_comm, cuts, sizeof(cuts));
+    if (!cuts[parts]) return 0;
+
+    if (context->rank == 0 && options->step > 0) {
+        printf("Iteration %7d\tRepartitioned for an imbalance of %.1f%%, widths", iteration, 100.0 * *imbalance);
+        for (k = 0; k < context->dims[0]; k++) printf(" %d", cuts[k+1] - cuts[k]);
+        printf(", heights");
+        for (k = context->dims[0] + 1; k < parts - 1; k++) printf(" %d", cuts[k+1] - cuts[k]);
+        printf("\n");
+    }
+    kept = (int *) malloc(parts * sizeof(int));
+    memcpy(kept, cuts, parts * sizeof(int));
+    solve_partition(context, kept);
+    return 1;
+}
+
+/**
+ * @brief Iterate without waiting for the neighbours' halos, until a synchronised sweep
+ *        confirms convergence.
+ *
+ * Each process iterates with the newest halos it has, see ::update_async, while a
+ * non-blocking reduce of the largest delta since the last one is always in flight. Once
+ * one finds every process below delta, or the iteration limit reached, the processes stop
+ * together, collect the halos still in flight, and make one bulk synchronous iteration
+ * with ::update_tick. Its global delta is exact, so the solve only ends if it agrees,
+ * otherwise asynchronous iteration resumes.
+ * @param context the context
+ * @param options the options for the solve
+ * @param return_val stores this process's part of the last iteration
+ * @param global_delta stores the global delta of the last iteration
+ * @param phase adds up the seconds spent in each phase, if publishing metrics
+ * @return the iterations of the process that made the most
+ */
+static int solve_async (reconstruct_context * context, const reconstruct_options * options,
+                        step_return * return_val, real * global_delta, double * phase) {
+    image_dimensions img_dim = context->img_dim;
+    MPI_Comm cart_comm = context->cart_comm;
+    int rank = context->rank;
+    /* the synchronised sweep is an iteration too */
+    int limit = options->iterations - 1;
+    int iteration = 0, checking, verifies = 0;
+    /* the largest delta since the last check and the iterations made, then their maxima */
+    real local[2], global[2], window, iterations, global_average;
+    double mark = 0.0;
+    MPI_Request request;
+
+    *global_delta = FLT_MAX;
+    if (options->iterations < 1) return 0;
+
+    /* every process stops on the same reduced values, so they all leave together */
+    while (1) {
+        async_start(cart_comm, img_dim);
+        window = 0.0;
+        checking = 0;
+        while (1) {
+            if (iteration < limit) {
+                if (metrics_enabled) mark = get_time();
+                *return_val = update_async(cart_comm, rank, img_dim, context->edge, context->old, context->new);
+                if (metrics_enabled) phase[METRICS_COMPUTE] += get_time() - mark;
+                if (return_val->delta > window) window = return_val->delta;
+                iteration++;
+            }
+
+            if (checking && requests_test(1, &request, 0)) {
+                checking = 0;
+                /* the rate is not tracked, so there is no prediction */
+                if (metrics_enabled) solve_publish((int) global[1], global[0], global[0], 1.0, options->delta, phase);
+                if (global[0] <= options->delta || global[1] >= limit) break;
+            }
+            if (!checking) {
+                local[0] = window;
+                local[1] = iteration;
+                window = 0.0;
+                reduce_start(cart_comm, MPI_MAX, local, global, 2, &request);
+                checking = 1;
+            }
+        }
+        async_finish(context->old);
+
+        /* every process now has its neighbours' newest edges, so this iteration is exact */
+        repro_wanted = options->step > 0 ? REPRO_SUM : 0;
+        *return_val = update_tick(cart_comm, rank, img_dim, context->edge, context->old, context->new, context->state);
+        repro_wanted = 0;
+        iteration++;
+        verifies++;
+        reduce(cart_comm, MPI_MAX, &(return_val->delta), global_delta);
+        if (metrics_enabled) solve_publish(iteration, *global_delta, *global_delta, 1.0, options->delta, phase);
+
+        if (options->step > 0) {
+            reduce_repro(cart_comm, &(return_val->sum), &global_average);
+            if (rank == 0)
+                printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", iteration,
+                    global_average / (img_dim.m * img_dim.n), *global_delta);
+        }
+        if (*global_delta <= options->delta || global[1] >= limit) break;
+    }
+
+    iterations = iteration;
+    reduce(cart_comm, MPI_MAX, &iterations, &(local[0]));
+    if (rank == 0)
+        printf("Asynchronous: %d synchronised sweeps\n", verifies);
+    return (int) local[0];
+}
+
+/**
+ * @brief Reconstruct the loaded image
+ * @param context the context
+ * @param options the options for the solve, see ::reconstruct_default_options
+ * @param result stores what the solve did
+ * @return 0 on success, or -1 if the options are not valid
+ */
+int reconstruct_solve (reconstruct_context * context, const reconstruct_options * options, reconstruct_result * result) {
+    int iteration;
+    int s, steps, reduced, confirming = 0;
+    double t0;
+    image_dimensions img_dim = context->img_dim;
+    MPI_Comm cart_comm = context->cart_comm;
+    int rank = context->rank;
+    real threshold;
+    /* Set inital global values. */
+    real global_delta = FLT_MAX,  // Using the max float means the first loop will always occur
+         global_average = 1.0,
+         measure = FLT_MAX;
+    convergence conv = {-1, 0.0, 1.0};
+    /* Initialise the return value for the update_step */
+    step_return return_val = {1.0};
+    /* blocks to skip once converged */
+    active_blocks active;
+    repro_sum sum;
+    real computed, total, snapshot_time, halo_counts, halo_wait, global_counts, global_wait, swaps_ready;
+    /* how close float halos can get to the solution, -1 until measured */
+    real rounding = -1.0, local_rounding;
+    int swaps, ready;
+    double wait;
+    /* only timed if publishing metrics, see metrics.c, or balancing */
+    double phase[METRICS_PHASES] = {0.0}, mark = 0.0, busy, balanced = 0.0;
+    int timed = metrics_enabled || options->balance > 0;
+
+    if (options->tile_depth < 1 || options->active_block < 0 || options->warm_start < 0
+        || options->check_interval < 1 || options->snapshot_every < 0 || options->poll_rows < 0
+        || options->stop < RECONSTRUCT_STOP_DELTA || options->stop > RECONSTRUCT_STOP_ERROR
+        || (options->active_block > 0 && options->tile_depth > 1)
+        || (options->async && (options->tile_depth > 1 || options->active_block > 0
+            || options->stop != RECONSTRUCT_STOP_DELTA || options->snapshot_every > 0))
+        || options->balance < 0 || (options->balance > 0 && (options->tile_depth > 1 || options->active_block > 0
+            || options->snapshot_every > 0 || options->async))
+        || (options->in_place && (options->tile_depth > 1 || options->active_block > 0 || options->async
+            || context->img_dim.mp < 4 || context->img_dim.np < 4)))
+        return -1;
+
+    /* updating in place never needs a second grid */
+    if (!options->in_place && context->new == NULL)
+        context->new = (real **) grid_alloc(sizeof(real), context->img_dim.mp+2, context->img_dim.np+2);
+
+    /* blocks that converge part way through are replayed from a saved copy */
+    if (options->tile_depth > context->tile_depth) {
+        free(context->results);
+        context->results = (step_return *) malloc(options->tile_depth * sizeof(step_return));
+        context->tile_depth = options->tile_depth;
+    }
+    if (options->tile_depth > 1 && context->save == NULL)
+        context->save = (real **) grid_alloc(sizeof(real), img_dim.mp+2, img_dim.np+2);
+
+    /* the warm start and the async iterations never print their sums */
+    repro_wanted = 0;
+    result->coarse_iterations = 0;
+    result->coarse_time = 0.0;
+    if (!(options->keep_guess && context->solved)) {
+        setup_reconstruct(cart_comm, rank, img_dim, context->old);
+
+        if (options->warm_start > 0) {
+            t0 = get_time();
+            result->coarse_iterations = warm_start(cart_comm, rank, img_dim, context->edge, context->old, options->warm_start, options->delta, options->iterations);
+            result->coarse_time = get_time() - t0;
+        }
+    }
+
+    if (options->active_block > 0) {
+        threshold = options->active_threshold < 0.0 ? ACTIVE_FRACTION * options->delta : options->active_threshold;
+        /* frozen blocks hold their neighbours back, so a looser one converges away from the full solve */
+        if (threshold > ACTIVE_FRACTION * options->delta) threshold = ACTIVE_FRACTION * options->delta;
+        active_init(&active, img_dim, options->active_block, threshold);
+    }
+
+    if (options->snapshot_every > 0)
+        snapshot_open(cart_comm, rank, context->size, img_dim, options->snapshot_every, options->snapshot);
+
+    /* only time the swaps of the solve itself, not of the warm start */
+    halo_poll(options->poll_rows);
+    halo_precision(0);
+    halo_timing(&swaps, &ready, &wait);
+
+    result->rebalances = 0;
+    result->imbalance = 0.0;
+    t0 = get_time();
+    metrics_start(img_dim.m, img_dim.n, context->size > 0 ? context->size : 1, options->stop, options->iterations, options->delta);
+
+    /* Reconstruct the image */
+    iteration = 0;
+    if (options->async) {
+        iteration = solve_async(context, options, &return_val, &global_delta, phase);
+        measure = global_delta;
+    }
+
+    /* the serial code has no halos to round */
+    reduced = options->halo_float && context->size > 1;
+    halo_precision(reduced);
+    while ((iteration < options->iterations) && (measure > options->delta)) {
+        /* the wavefront needs at least as many rows as operations, and must not overshoot */
+        steps = options->tile_depth;
+        if (steps > img_dim.mp) steps = img_dim.mp;
+        if (steps > options->iterations - iteration) steps = options->iterations - iteration;
+
+        repro_wanted = solve_wanted(options, iteration, steps);
+        if (timed) mark = get_time();
+        if (steps > 1)
+            update_block(cart_comm, rank, img_dim, context->edge, context->old, context->new, context->save, steps, context->results, context->state);
+        else if (options->in_place)
+            context->results[0] = update_in_place(cart_comm, rank, img_dim, context->edge, context->old, context->state);
+        else if (options->active_block > 0) {
+            /* keep every block swept until the stop has been measured with them all */
+            if (confirming) active_wake(&active);
+            context->results[0] = update_active(cart_comm, rank, img_dim, context->edge, context->old, context->new, &active, context->state);
+        } else
+            context->results[0] = update_tick(cart_comm, rank, img_dim, context->edge, context->old, context->new, context->state);
+        if (timed) phase[METRICS_COMPUTE] += get_time() - mark;
+
+        for (s = 0; (s < steps) && (measure > options->delta); s++) {
+            return_val = context->results[s];
+            /* skipping checks saves a reduce, but may run up to check_interval-1 extra iterations */
+            if ((iteration + 1) % options->check_interval == 0 || iteration + 1 == options->iterations
+                || (options->step > 0 && iteration % options->step == 0)) {
+                if (metrics_enabled) mark = get_time();
+                measure = solve_measure(cart_comm, img_dim, options->stop, &return_val, iteration, &conv, &global_delta);
+                if (metrics_enabled) {
+                    phase[METRICS_REDUCE] += get_time() - mark;
+                    solve_publish(iteration + 1, global_delta, measure, conv.rate, options->delta, phase);
+                }
+            }
+
+            if (options->step > 0 && iteration % options->step == 0) {
+                reduce_repro(cart_comm, &(return_val.sum), &global_average);
+                /* the residual norms do not need the delta, but it is printed */
+                if (options->stop == RECONSTRUCT_STOP_RESIDUAL_L2 || options->stop == RECONSTRUCT_STOP_ERROR)
+                    reduce(cart_comm, MPI_MAX, &(return_val.delta), &global_delta);
+                if (rank == 0) {
+                    global_average /=  (img_dim.m * img_dim.n);
+                    printf("Iteration %7d\tAverage Pixel = %.16f\tGlobal Delta = %.16f\n", iteration, global_average, global_delta);
+                    if (options->stop != RECONSTRUCT_STOP_DELTA)
+                        printf("Iteration %7d\tStop Measure = %.16f\tRate = %.8f\tPredicted Left = %d\n", iteration, measure,
+                            conv.rate, solve_remaining(measure, options->delta, conv.rate));
+                }
+            }
+
+            iteration++;
+        }
+
+        /* converged part way through a block, so replay it up to the converged operation */
+        if (s < steps) {
+            copy_tile(img_dim, context->save, context->old);
+            repro_wanted = 0;
+            while (s-- > 0) update_tick(cart_comm, rank, img_dim, context->edge, context->old, context->new, context->state);
+        }
+
+        if (options->snapshot_every > 0) snapshot_tick(iteration, context->old);
+
+        /* the first measurement sets the partition, later ones correct it */
+        if (options->balance > 0 && context->size > 1 && iteration % options->balance == 0
+            && measure > options->delta && iteration < options->iterations) {
+            busy = phase[METRICS_COMPUTE] - halo_waited();
+            if (solve_balance(context, options, iteration, busy - balanced, options->balance, &(result->imbalance))) {
+                img_dim = context->img_dim;
+                result->rebalances++;
+            }
+            balanced = busy;
+        }
+
+        /* once every halo has been sent, bound their rounding, the same on every process */
+        if (reduced && rounding < 0.0 && iteration > 0) {
+            local_rounding = halo_rounding();
+            reduce(cart_comm, MPI_MAX, &local_rounding, &rounding);
+        }
+
+        /* converged with rounded halos, or as near as they allow, so only stop with full precision ones */
+        if (reduced && (measure <= options->delta || measure <= rounding) && iteration < options->iterations) {
+            reduced = 0;
+            halo_precision(0);
+            if (rank == 0 && options->step > 0 && measure <= options->delta)
+                printf("Iteration %7d\tConverged with float halos, confirming with full precision\n", iteration);
+            else if (rank == 0 && options->step > 0)
+                printf("Iteration %7d\tDelta is below the float halos' rounding of %.1e, continuing with full precision\n",
+                    iteration, rounding);
+            measure = FLT_MAX;
+        }
+
+        /* skipped blocks report their last delta, so only stop once every block has been swept */
+        if (options->active_block > 0 && iteration < options->iterations) {
+            if (measure <= options->delta && !confirming) {
+                confirming = 1;
+                active_wake(&active);
+                if (rank == 0 && options->step > 0)
+                    printf("Iteration %7d\tConverged with skipped blocks, confirming with every block\n", iteration);
+                measure = FLT_MAX;
+            } else if (measure != FLT_MAX) {
+                confirming = 0;
+            }
+        }
+    }
+    halo_precision(0);
+    result->time = get_time() - t0;
+    metrics_finish();
+
+    /* how many swaps the interior sweep covered, and how long the rest were waited for */
+    halo_timing(&swaps, &ready, &wait);
+    halo_counts = swaps;
+    reduce(cart_comm, MPI_SUM, &halo_counts, &global_counts);
+    result->halo_ready = -1.0;
+    if (global_counts > 0.0) {
+        halo_counts = ready;
+        reduce(cart_comm, MPI_SUM, &halo_counts, &swaps_ready);
+        result->halo_ready = swaps_ready / global_counts;
+    }
+    halo_wait = wait;
+    reduce(cart_comm, MPI_SUM, &halo_wait, &global_wait);
+    result->halo_wait = context->size > 0 ? global_wait / context->size : global_wait;
+
+    result->snapshots = 0;
+    result->snapshots_skipped = 0;
+    result->snapshot_time = 0.0;
+    if (options->snapshot_every > 0) {
+        snapshot_time = snapshot_close(&(result->snapshots), &(result->snapshots_skipped));
+        reduce(cart_comm, MPI_MAX, &snapshot_time, &(result->snapshot_time));
+    }
+    result->iterations = iteration;
+
+    if (options->stop == RECONSTRUCT_STOP_RESIDUAL_L2 || options->stop == RECONSTRUCT_STOP_ERROR)
+        reduce(cart_comm, MPI_MAX, &(return_val.delta), &global_delta);
+    result->delta = global_delta;
+    result->measure = measure;
+    result->rate = conv.rate;
+    result->remaining = solve_remaining(measure, options->delta, conv.rate);
+
+    /* the last iteration need not have added up its sum, but it left it in old */
+    repro_wanted = 0;
+    tile_sum(img_dim, context->old, &sum);
+    reduce_repro(cart_comm, &sum, &global_average);
+    result->average = global_average / (img_dim.m * img_dim.n);
+
+    result->skipped = 0.0;
+    if (options->active_block > 0) {
+        reduce(cart_comm, MPI_SUM, &(active.computed), &computed);
+        reduce(cart_comm, MPI_SUM, &(active.total), &total);
+        result->skipped = 1.0 - computed/total;
+        active_free(&active);
+    }
+
+    context->solved = 1;
+    return 0;
+}
+
+/**
+ * @brief Scale the reconstructed image to grey levels and gather them on rank 0
+ * @param context the context
+ */
+static void reconstruct_gather (reconstruct_context * context) {
+    /* every rank scales its own data, so only grey levels need to be gathered */
+    quantise(context->cart_comm, context->img_dim, context->old, context->grey);
+    gather_data(context->cart_comm, context->rank, context->size, context->img_dim, context->grey, context->grey_buf);
+}
+
+/**
+ * @brief Fetch the reconstructed image as grey levels, scaled as they would be in a PGM file
+ * @param context the context
+ * @param grey stores the m x n grey levels, only used on rank 0
+ */
+void reconstruct_fetch (reconstruct_context * context, greynum * grey) {
+    int i, j;
+    image_dimensions img_dim = context->img_dim;
+
+    reconstruct_gather(context);
+
+    if (context->rank == 0) {
+        for (j = 0; j < img_dim.n; j++) {
+            for (i = 0; i < img_dim.m; i++) {
+                grey[j*img_dim.m + i] = context->grey_buf[i][img_dim.n-j-1];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Write the reconstructed image to a PGM file
+ * @param context the context
+ * @param filename the file to write, only used on rank 0
+ * @return 0, or -1 on rank 0 if the file could not be written
+ */
+int reconstruct_save_file (reconstruct_context * context, char * filename) {
+    reconstruct_gather(context);
+    return image_write(context->rank, filename, context->img_dim, context->grey_buf);
+}
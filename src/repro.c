@@ -0,0 +1,179 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file repro.c
+ * @author James Clark
+ * @brief Reproducible sums, which give the same bits however the values are split up.
+ *
+ * The sums and norms of the image are added up in different orders by different numbers
+ * of processes, tile depths and active blocks, and floating point addition is not
+ * associative, so they used to differ in the last bits between runs. A ::repro_sum cuts
+ * each value in to two fixed-point parts and adds those as integers instead, which only
+ * drops the bits of each value below 2^REPRO_LOW and is otherwise exact. The max delta
+ * needs nothing, as max is already associative.
+ *
+ * The squared deltas are added every iteration the l2 or error stop measure is checked,
+ * so ::repro_add_squares adds a whole row at once. Where the processor has AVX2 and FMA, it cuts
+ * four values at a time with floating point operations that are all exact, adds the parts
+ * in 64 bit integers and only adds those to the 128 bit sum once for each ::REPRO_CHUNK
+ * values, giving the same sum as ::repro_add in around a third of the time.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <repro.h>
+
+/** Values added in 64 bit integers before they are added to a sum, so no part can overflow */
+#define REPRO_CHUNK 1024
+/** The exponent of the second cut of the low part in ::repro_add_squares, so every part is below 2^31 */
+#define REPRO_MID (-47)
+/** The largest square ::repro_add_squares cuts in vectors, larger chunks use ::repro_add */
+#define REPRO_VECTOR_LIMIT 0x1p35
+
+/**
+ * The sums the update functions add up, REPRO_SUM and REPRO_SQUARE bits. A sum adds up to
+ * half again to the sweep, so they are only added up on the iterations that print or check
+ * them, and the others are left zero.
+ */
+int repro_wanted = 0;
+
+/**
+ * @brief Carry the low part of a sum in to the high part, leaving it in [0, 2^(REPRO_SPLIT -
+ *        REPRO_LOW)). A normalised sum has only one representation of its value.
+ * @param sum the sum
+ */
+static void repro_normalise (repro_sum * sum) {
+    /* rounds towards minus infinity, so the remainder is never negative */
+    __int128 carry = sum->low >> (REPRO_SPLIT - REPRO_LOW);
+
+    sum->low -= carry * ((__int128) 1 << (REPRO_SPLIT - REPRO_LOW));
+    sum->high += carry;
+}
+
+/**
+ * @brief Add one sum to another
+ * @param sum the sum to add to
+ * @param other the sum to add
+ */
+void repro_merge (repro_sum * sum, const repro_sum * other) {
+    sum->high += other->high;
+    sum->low += other->low;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+typedef double repro_v4d __attribute__ ((vector_size (32)));
+typedef int64_t repro_v4i __attribute__ ((vector_size (32)));
+
+/** Adding this rounds a value below 2^51 to the nearest integer, exactly, and leaves that integer in the low bits */
+#define REPRO_MAGIC 0x1.8p52
+
+/**
+ * @brief Round four values to integers, adding the integers to a part
+ * @param y the values, of magnitude below 2^51
+ * @param part adds the integers
+ * @param down 1 to round down, 0 to round to the nearest
+ * @return the integers, as values
+ */
+__attribute__ ((target ("avx2,fma")))
+static inline repro_v4d repro_round (repro_v4d y, repro_v4i * part, int down) {
+    const repro_v4d magic = {REPRO_MAGIC, REPRO_MAGIC, REPRO_MAGIC, REPRO_MAGIC};
+    repro_v4d rounded = y + magic, whole = rounded - magic;
+
+    *part += (repro_v4i) rounded - (repro_v4i) magic;
+    /* all ones, or -1, where it was rounded up */
+    if (down) *part += (repro_v4i) (whole > y);
+    return whole;
+}
+
+/**
+ * @brief Add the squared differences of as many whole chunks of four values as there are, in vectors
+ * @param sum the sum
+ * @param a the first values
+ * @param b the second values
+ * @param n the number of values
+ * @return the number of values added
+ */
+__attribute__ ((target ("avx2,fma")))
+static int repro_squares_vector (repro_sum * sum, const real * a, const real * b, int n) {
+    const repro_v4d limit = {REPRO_VECTOR_LIMIT, REPRO_VECTOR_LIMIT, REPRO_VECTOR_LIMIT, REPRO_VECTOR_LIMIT};
+    repro_v4d x, va, vb;
+    repro_v4i high, mid, low, large;
+    int c, j, end;
+
+    for (c = 0; c + 4 <= n; c = end) {
+        end = c + REPRO_CHUNK < n ? c + REPRO_CHUNK : n;
+        end = c + (end - c)/4*4;
+        high = mid = low = large = (repro_v4i) {0, 0, 0, 0};
+
+        for (j = c; j < end; j += 4) {
+            memcpy(&va, a + j, sizeof(va));
+            memcpy(&vb, b + j, sizeof(vb));
+            x = (va - vb) * (va - vb);
+            large |= x >= limit;
+            /* x is high*2^-16 + mid*2^-47 + low*2^-78 and less than 2^-78 over, every step exact.
+             * Rounding the first two to the nearest moves bits between the parts, but not their total */
+            x -= repro_round(x * 0x1p16, &high, 0) * 0x1p-16;
+            x -= repro_round(x * 0x1p47, &mid, 0) * 0x1p-47;
+            repro_round(x * 0x1p78, &low, 1);
+        }
+
+        if (large[0] | large[1] | large[2] | large[3]) {
+            for (j = c; j < end; j++) repro_add(sum, (a[j] - b[j]) * (a[j] - b[j]));
+        } else {
+            sum->high += high[0] + high[1] + high[2] + high[3];
+            sum->low += (__int128) (mid[0] + mid[1] + mid[2] + mid[3]) * ((__int128) 1 << (REPRO_MID - REPRO_LOW))
+                      + (low[0] + low[1] + low[2] + low[3]);
+        }
+    }
+    return c;
+}
+#endif
+
+/**
+ * @brief Add the squared differences of two rows of values to a sum, the same as ::repro_add
+ *        of each one would
+ * @param sum the sum
+ * @param a the first values
+ * @param b the second values
+ * @param n the number of values
+ */
+void repro_add_squares (repro_sum * sum, const real * a, const real * b, int n) {
+    int j = 0;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    if (sizeof(real) == sizeof(double) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        j = repro_squares_vector(sum, a, b, n);
+#endif
+    for (; j < n; j++) repro_add(sum, (a[j] - b[j]) * (a[j] - b[j]));
+}
+
+/**
+ * @brief Round a sum to a real number
+ * @param sum the sum
+ * @return the value of the sum
+ */
+real repro_value (const repro_sum * sum) {
+    repro_sum copy = *sum;
+
+    repro_normalise(&copy);
+    /* the same parts always round the same way */
+    return (real) copy.high * 0x1p-16 + (real) copy.low * 0x1p-78;
+}
@@ -23,20 +23,30 @@
  * @brief Serial Communication Code
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <mpi.h>
 
 #include <precision.h>
 #include <functions.h>
 
-void get_cart_comm (int * rank, int * size, int * dims, MPI_Comm * cart_comm) {
+int get_cart_comm (MPI_Comm comm, int * rank, int * size, int * dims, MPI_Comm * cart_comm) {
+    /* the only layout of one process */
+    if (dims[0] > 1 || dims[1] > 1) return -1;
     *cart_comm = (MPI_Comm) 0;
+    *rank = 0;
+    *size = 1;
     dims[0] = 1;
     dims[1] = 1;
+    return 0;
+}
+
+void free_cart_comm (MPI_Comm * cart_comm) {
 }
 
 /* set local to global for serial */
-void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global) {
+void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, edgenum ** local, edgenum ** global) {
     int i, j;
     for (i = 0; i < img_dim.mp; i++) {
         for (j = 0; j < img_dim.np; ++j) {
@@ -45,7 +55,7 @@ void scatter_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_
     }
 }
 
-void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, real ** local, real ** global) {
+void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global) {
     int i, j;
     for (i = 0; i < img_dim.mp; i++) {
         for (j = 0; j < img_dim.np; ++j) {
@@ -54,7 +64,79 @@ void gather_data (MPI_Comm cart_comm, int rank, int size, image_dimensions img_d
     }
 }
 
+/* the copy is done at once, so there is nothing left to complete */
+void gather_start (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, greynum ** local, greynum ** global, MPI_Request * requests, int * count) {
+    gather_data(cart_comm, rank, size, img_dim, local, global);
+    *count = 0;
+}
+
+/* There are no halo swaps to plan in serial */
+void halo_release (update_state * state) {
+}
+
+void halo_poll (int rows) {
+}
+
+void halo_precision (int reduced) {
+}
+
+real halo_rounding () {
+    return 0.0;
+}
+
+void halo_timing (int * swaps, int * ready, double * wait) {
+    *swaps = 0;
+    *ready = 0;
+    *wait = 0.0;
+}
+
+double halo_waited () {
+    return 0.0;
+}
+
 /* No reduce is needed in serial, just give back what was given */
 void reduce (MPI_Comm cart_comm, MPI_Op op, real * local, real * global) {
     *global = *local;
 }
+
+void reduce_repro (MPI_Comm cart_comm, repro_sum * local, real * global) {
+    *global = repro_value(local);
+}
+
+/* The only process already has the data */
+void broadcast (MPI_Comm comm, void * data, int bytes) {
+}
+
+/* The only process is always a member */
+void split_comm (MPI_Comm comm, int member, MPI_Comm * new_comm) {
+    *new_comm = comm;
+}
+
+void free_comm (MPI_Comm * comm) {
+}
+
+void dup_comm (MPI_Comm comm, MPI_Comm * new_comm) {
+    *new_comm = comm;
+}
+
+void reduce_start (MPI_Comm comm, MPI_Op op, real * local, real * global, int count, MPI_Request * request) {
+    memcpy(global, local, count * sizeof(real));
+}
+
+/* nothing is ever left pending in serial */
+int requests_test (int count, MPI_Request * requests, int wait) {
+    return 1;
+}
+
+/* The only process's memory is all there is */
+/* There is one tile, so the partition never changes */
+void migrate_tile (MPI_Comm cart_comm, int rank, int size, image_dimensions from, image_dimensions to, MPI_Datatype type, void * src, void * dst) {
+}
+
+char * gather_bytes (MPI_Comm comm, int rank, int size, void * local, int bytes, int * counts) {
+    char * global = (char *) malloc(bytes + 1);
+
+    memcpy(global, local, bytes);
+    counts[0] = bytes;
+    return global;
+}
@@ -43,12 +43,31 @@ void sawtooth (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** o
     }
 }
 
+/* the only process owns both sawtooth boundaries */
+void boundary_sides (MPI_Comm cart_comm, int * low, int * high) {
+    *low = 1;
+    *high = 1;
+}
+
+/* the only tile is the whole image */
+void tile_extent (MPI_Comm cart_comm, int rank, image_dimensions img_dim, int * coords, int * offset, int * length) {
+    coords[0] = coords[1] = 0;
+    offset[0] = offset[1] = 0;
+    length[0] = img_dim.mp;
+    length[1] = img_dim.np;
+}
+
 double get_time () {
     struct timeval mtime;
     gettimeofday(&mtime, NULL);
     return ((mtime.tv_sec) * 1000000u + mtime.tv_usec) / 1.e6;
 }
 
+/* there is only one clock */
+double clock_offset (MPI_Comm comm, int rank, int size) {
+    return 0.0;
+}
+
 /* set up rank/size */
 void init (int argc, char * argv[], int * rank, int * size) {
     *rank = 0;
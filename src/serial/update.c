@@ -23,40 +23,266 @@
  * @brief Serial Update Code
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <math.h>
 
+#include <grid.h>
+#include <trace.h>
+#include <counters.h>
 #include <precision.h>
 #include <functions.h>
 
-step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, real ** edge, real ** old, real ** new){
-    int i, j;
-    real delta = 0.0;
-    step_return retval = {0.0, 0.0};
+/* periodic boundary conditions for left and right */
+static void periodic (image_dimensions img_dim, real ** old) {
+    int j;
 
-    /* periodic boundary conditions for left and right */
     for (j = 1; j < (img_dim.np+1); j++) {
       old[0][j]    = old[img_dim.mp][j];
       old[img_dim.mp+1][j] = old[1][j];
     }
+}
+
+step_return update_tick (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, update_state * state){
+    int i, j;
+    real delta = 0.0;
+    step_return retval = {0.0};
+    double t = trace_begin();
+
+    periodic(img_dim, old);
 
     /* reconstruct image, halo swap not needed in serial */
+    counters_start();
     for (i = 1; i < (img_dim.mp+1); i++) {
         for (j = 1; j < (img_dim.np+1); j++) {
             new[i][j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
         }
     }
+    counters_stop(COUNTERS_STENCIL, img_dim.mp*img_dim.np);
 
     /* set old = new for next iteration, while finding the max delta value */
+    counters_start();
     for (i = 1; i < (img_dim.mp + 1); i++) {
+        if (repro_wanted & REPRO_SQUARE) repro_add_squares(&(retval.square), &(new[i][1]), &(old[i][1]), img_dim.np);
         for (j = 1; j < (img_dim.np + 1); j++) {
             delta = fabs(new[i][j] - old[i][j]);
             if (delta > retval.delta) {
                 retval.delta = delta;
             }
-            retval.sum += new[i][j];
+            if (repro_wanted & REPRO_SUM) repro_add(&(retval.sum), new[i][j]);
             old[i][j] = new[i][j];
         }
     }
+    counters_stop(COUNTERS_COPY, img_dim.mp*img_dim.np);
+    trace_end("sweep", t);
+    return retval;
+}
+
+/** What the updates keep between calls, one for each context: the two rows of new values of ::update_in_place, grown as needed */
+struct update_state {
+    int length;   /**< The length of each row */
+    real * rows;  /**< Both rows, in one allocation */
+};
+
+/* the rows are made by the first update in place */
+update_state * update_state_create () {
+    return (update_state *) calloc(1, sizeof(update_state));
+}
+
+void update_state_free (update_state * state) {
+    if (state == NULL) return;
+
+    free(state->rows);
+    free(state);
+}
+
+/**
+ * @brief Performs one reconstruct operation in place, without a second grid.
+ *
+ * Each row is computed in to one of two rows and written back once the row after it has
+ * been computed, as nothing needs its old values after that. The periodic halos are copied
+ * first, so every pixel is computed from exactly the same operands as ::update_tick.
+ */
+step_return update_in_place (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, update_state * state){
+    int i, j;
+    real delta;
+    real * row;
+    step_return retval = {0.0};
+    double t = trace_begin();
+
+    if (state->length < img_dim.np+2) {
+        free(state->rows);
+        state->length = img_dim.np+2;
+        state->rows = (real *) malloc(2 * state->length * sizeof(real));
+    }
+
+    periodic(img_dim, old);
+
+    counters_start();
+    for (i = 1; i < (img_dim.mp+2); i++) {
+        if (i < img_dim.mp+1) {
+            row = state->rows + (i & 1)*state->length;
+            for (j = 1; j < (img_dim.np+1); j++) {
+                row[j] = 0.25 * (old[i-1][j] + old[i+1][j] + old[i][j-1] + old[i][j+1] - edge[i][j]);
+            }
+        }
+
+        /* row i-1 is no longer needed, so set it to its new value while finding the max delta */
+        if (i > 1) {
+            row = state->rows + ((i-1) & 1)*state->length;
+            if (repro_wanted & REPRO_SQUARE) repro_add_squares(&(retval.square), &(row[1]), &(old[i-1][1]), img_dim.np);
+            for (j = 1; j < (img_dim.np+1); j++) {
+                delta = fabs(row[j] - old[i-1][j]);
+                if (delta > retval.delta) {
+                    retval.delta = delta;
+                }
+                if (repro_wanted & REPRO_SUM) repro_add(&(retval.sum), row[j]);
+                old[i-1][j] = row[j];
+            }
+        }
+    }
+    counters_stop(COUNTERS_STENCIL, img_dim.mp*img_dim.np);
+    trace_end("sweep", t);
+    return retval;
+}
+
+/* skips blocks that have converged, see active.c */
+step_return update_active (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, active_blocks * active, update_state * state){
+    step_return retval;
+    double t = trace_begin();
+
+    periodic(img_dim, old);
+
+    active_sweep(active, img_dim, edge, old, new, 0);
+    active_sweep(active, img_dim, edge, old, new, 1);
+
+    retval = active_finish(active, img_dim, old, new);
+    trace_end("sweep", t);
     return retval;
 }
+
+/**
+ * @brief Performs several reconstruct operations on a skewed wavefront.
+ *
+ * Row r of operation s is computed straight after row r+1 of operation s-1, so each
+ * row is taken through every operation while its neighbours are still in cache and
+ * the whole block costs roughly one pass over memory. Operation s is stored in new
+ * when s is odd and in old when s is even, which is safe because of the skew.
+ *
+ * The periodic wrap in dim 0 is handled with steps ghost rows on either side, which
+ * hold copies of the wrapped rows and are recomputed redundantly. Each pixel is
+ * computed with exactly the same operands as update_tick, so the results are identical.
+ * @param img_dim the dimensions of the local and global data, mp must be at least steps
+ * @param edge stores the original edge data
+ * @param old stores the previous operation's data, and the result of the block
+ * @param new work space for the odd operations
+ * @param save if not NULL, stores a copy of old as it was before the block
+ * @param steps the number of operations to perform
+ * @param results stores the ::step_return of each operation
+ */
+void update_block (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new, real ** save, int steps, step_return * results, update_state * state){
+    int i, j, r, s, w, lo, hi;
+    int rows = img_dim.mp + 2*steps;
+    real delta = 0.0;
+    real * prev, * next, * up, * down;
+    real ** ghost;
+    real ** level[2];
+    edgenum ** edge_rows;
+    double t = trace_begin();
+
+    /* row pointers for both parities and the edge, indexed by r+steps-1 for r in [1-steps, mp+steps] */
+    level[0]  = (real **) malloc(rows * sizeof(real *));
+    level[1]  = (real **) malloc(rows * sizeof(real *));
+    edge_rows = (edgenum **) malloc(rows * sizeof(edgenum *));
+    ghost = (real **) grid_alloc(sizeof(real), 4*steps, img_dim.np+2);
+
+    for (r = 1-steps; r < img_dim.mp+steps+1; r++) {
+        /* the row this one is a periodic copy of */
+        i = (r < 1) ? r + img_dim.mp : (r > img_dim.mp) ? r - img_dim.mp : r;
+        edge_rows[r+steps-1] = edge[i];
+
+        if (i == r) {
+            level[0][r+steps-1] = old[i];
+            level[1][r+steps-1] = new[i];
+            /* the sawtooth is read from both parities */
+            new[i][0] = old[i][0];
+            new[i][img_dim.np+1] = old[i][img_dim.np+1];
+        } else {
+            /* ghost rows take 0..steps-1 and mp+steps+1.. in the ghost buffer */
+            j = (r < 1) ? r+steps-1 : r-img_dim.mp-1+steps;
+            level[0][r+steps-1] = ghost[2*j];
+            level[1][r+steps-1] = ghost[2*j+1];
+            memcpy(ghost[2*j], old[i], (img_dim.np+2) * sizeof(real));
+            ghost[2*j+1][0] = old[i][0];
+            ghost[2*j+1][img_dim.np+1] = old[i][img_dim.np+1];
+        }
+    }
+
+    for (s = 0; s < steps; s++) {
+        results[s].delta = 0.0;
+        repro_zero(&(results[s].sum));
+        repro_zero(&(results[s].square));
+    }
+
+    /* sweep the wavefront, operation s+1 trails operation s by one row */
+    for (w = 2-steps; w < img_dim.mp+steps; w++) {
+        for (s = 1; s < steps+1; s++) {
+            r = w - (s-1);
+            /* operation s only needs rows [1-steps+s, mp+steps-s] */
+            lo = 1-steps+s;
+            hi = img_dim.mp+steps-s;
+            if (r < lo || r > hi) continue;
+
+            prev = level[(s-1)%2][r+steps-1];
+            up   = level[(s-1)%2][r+steps-2];
+            down = level[(s-1)%2][r+steps];
+            next = level[s%2][r+steps-1];
+
+            if (s == 1 && save != NULL && r >= 1 && r <= img_dim.mp)
+                memcpy(save[r], prev, (img_dim.np+2) * sizeof(real));
+
+            for (j = 1; j < (img_dim.np+1); j++) {
+                next[j] = 0.25 * (up[j] + down[j] + prev[j-1] + prev[j+1] - edge_rows[r+steps-1][j]);
+            }
+
+            /* only the real rows count towards the delta and sum */
+            if (r >= 1 && r <= img_dim.mp) {
+                if (repro_wanted & REPRO_SQUARE) repro_add_squares(&(results[s-1].square), &(next[1]), &(prev[1]), img_dim.np);
+                for (j = 1; j < (img_dim.np+1); j++) {
+                    delta = fabs(next[j] - prev[j]);
+                    if (delta > results[s-1].delta) {
+                        results[s-1].delta = delta;
+                    }
+                    if (repro_wanted & REPRO_SUM) repro_add(&(results[s-1].sum), next[j]);
+                }
+            }
+        }
+    }
+
+    /* an odd number of operations leaves the result in new */
+    if (steps % 2 == 1) {
+        for (i = 1; i < (img_dim.mp + 1); i++) {
+            for (j = 1; j < (img_dim.np + 1); j++) {
+                old[i][j] = new[i][j];
+            }
+        }
+    }
+
+    grid_free(ghost);
+    free(edge_rows);
+    free(level[1]);
+    free(level[0]);
+    trace_end("wavefront block", t);
+}
+
+/* The only process has no neighbours to wait for, so there is nothing to swap */
+void async_start (MPI_Comm cart_comm, image_dimensions img_dim) {
+}
+
+step_return update_async (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, real ** new){
+    return update_tick(cart_comm, rank, img_dim, edge, old, new, NULL);
+}
+
+void async_finish (real ** old) {
+}
@@ -0,0 +1,401 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file serve.c
+ * @author James Clark
+ * @brief A job server, so the processes are started once for many images.
+ *
+ * Rank 0 listens on a UNIX domain socket. Each connection sends one line,
+ * "edge_file TAB output_file TAB iterations TAB delta", and gets one line back,
+ * "ok ..." with the timings or "error ..." with the reason. A line of "quit" stops the
+ * server. Jobs run one at a time. Each job is broadcast to every process, and solved by
+ * as many of them as suit the image size, see ::serve_processes. The contexts for each
+ * image size and process count are kept, so repeated sizes reuse their grids and
+ * communicators.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <mpi.h>
+
+#include <precision.h>
+#include <functions.h>
+
+/** Longest file name in a job */
+#define SERVE_PATH 1024
+/** Longest line sent to or from the server */
+#define SERVE_LINE (2*SERVE_PATH + 64)
+/** Longest reason a job is refused */
+#define SERVE_ERROR 128
+/** Pixels each process should have at least, so small images use fewer processes */
+#define SERVE_PIXELS (128*128)
+/** Number of contexts kept for reuse */
+#define SERVE_CONTEXTS 8
+/** Seconds to wait before accepting again when out of descriptors */
+#define SERVE_BACKOFF 1
+
+/** A job, as broadcast to every process */
+typedef struct {
+    int stop;                  /**< 1 if the server should stop */
+    int m;                     /**< The width of the image */
+    int n;                     /**< The height of the image */
+    int processes;             /**< The number of processes to solve it on */
+    int iterations;            /**< Maximum iterations */
+    double delta;              /**< Minimum delta value */
+    char edge[SERVE_PATH];     /**< The edge file */
+    char output[SERVE_PATH];   /**< The output file */
+} serve_job;
+
+/** A context kept for reuse, the same on every process */
+typedef struct {
+    int m;                     /**< The width of the images, 0 if unused */
+    int n;                     /**< The height of the images */
+    int processes;             /**< The number of processes */
+    reconstruct_context * context; /**< The context, NULL if this process is not a member */
+} serve_context;
+
+/**
+ * @brief Choose the number of processes for an image, fewer for small images so
+ *        communication does not outweigh the work, and so that the image splits evenly
+ * @param size the number of processes available
+ * @param m the width of the image
+ * @param n the height of the image
+ * @return the number of processes
+ */
+static int serve_processes (int size, int m, int n) {
+    int p, dims[2];
+
+    p = (m*n)/SERVE_PIXELS;
+    if (p > size) p = size;
+
+    for (; p > 1; p--) {
+        dims[0] = 0;
+        dims[1] = 0;
+        MPI_Dims_create(p, 2, dims);
+        if ((m % dims[0] == 0) && (n % dims[1] == 0)) break;
+    }
+    return p > 1 ? p : 1;
+}
+
+/**
+ * @brief Find the context for a job, creating it if needed. Called by every process
+ * @param contexts the kept contexts
+ * @param next the slot to replace when all are in use
+ * @param job the job
+ * @param rank the rank of the calling process
+ * @return the context, or NULL if this process does not take part
+ */
+static reconstruct_context * serve_context_for (serve_context * contexts, int * next, serve_job * job, int rank) {
+    int c;
+    MPI_Comm comm;
+
+    for (c = 0; c < SERVE_CONTEXTS; c++) {
+        if (contexts[c].m == job->m && contexts[c].n == job->n && contexts[c].processes == job->processes)
+            return contexts[c].context;
+    }
+
+    c = *next;
+    *next = (*next + 1) % SERVE_CONTEXTS;
+    if (contexts[c].context != NULL) reconstruct_destroy(contexts[c].context);
+
+    contexts[c].m = job->m;
+    contexts[c].n = job->n;
+    contexts[c].processes = job->processes;
+    contexts[c].context = NULL;
+
+    split_comm(MPI_COMM_WORLD, rank < job->processes, &comm);
+    if (rank < job->processes) {
+        contexts[c].context = reconstruct_create(comm, job->m, job->n);
+        free_comm(&comm);
+    }
+    return contexts[c].context;
+}
+
+/**
+ * @brief Send a line to a client, ignoring clients that have gone away
+ * @param conn the connection
+ * @param line the line to send, including the newline
+ */
+static void serve_reply (int conn, char * line) {
+    if (send(conn, line, strlen(line), MSG_NOSIGNAL) < 0)
+        fprintf(stderr, "serve: could not reply to client\n");
+}
+
+/**
+ * @brief Read a line from a connection
+ * @param conn the connection
+ * @param line stores the line, without the newline
+ * @return 1 if a line was read, otherwise 0
+ */
+static int serve_read_line (int conn, char * line) {
+    int length = 0;
+    ssize_t got;
+
+    while (length < SERVE_LINE - 1) {
+        got = recv(conn, &line[length], 1, 0);
+        if (got <= 0) return 0;
+        if (line[length] == '\n') break;
+        length++;
+    }
+    line[length] = '\0';
+    return 1;
+}
+
+/**
+ * @brief Check that a file could be written, without creating or truncating it
+ * @param path the file
+ * @return 1 if the file, or the directory it would be made in, is writable, otherwise 0
+ */
+static int serve_writable (char * path) {
+    char dir[SERVE_PATH];
+
+    if (access(path, F_OK) == 0) return access(path, W_OK) == 0;
+    /* dirname may change its argument */
+    strcpy(dir, path);
+    return access(dirname(dir), W_OK) == 0;
+}
+
+/**
+ * @brief Parse and check a job on rank 0
+ * @param line the job line
+ * @param job stores the job
+ * @param size the number of processes available
+ * @param error stores the reason the job was rejected, at most SERVE_ERROR characters
+ * @return 1 if the job can run, otherwise 0
+ */
+static int serve_parse (char * line, serve_job * job, int size, char * error) {
+    FILE * file;
+    char * fields[4];
+    int f;
+
+    memset(job, 0, sizeof(serve_job));
+
+    if (strcmp(line, "quit") == 0) {
+        job->stop = 1;
+        return 1;
+    }
+
+    fields[0] = strtok(line, "\t");
+    for (f = 1; f < 4; f++) fields[f] = strtok(NULL, "\t");
+    if (fields[3] == NULL) {
+        sprintf(error, "expected edge_file, output_file, iterations and delta separated by tabs");
+        return 0;
+    }
+    if (strlen(fields[0]) >= SERVE_PATH || strlen(fields[1]) >= SERVE_PATH) {
+        sprintf(error, "file name too long");
+        return 0;
+    }
+    strcpy(job->edge, fields[0]);
+    strcpy(job->output, fields[1]);
+    job->iterations = atoi(fields[2]);
+    job->delta = atof(fields[3]);
+
+    if ((file = fopen(job->edge, "r")) == NULL) {
+        sprintf(error, "cannot open edge file");
+        return 0;
+    }
+    fclose(file);
+
+    /* a bad header would otherwise only be found once every process has the job */
+    if (image_check(job->edge, &(job->m), &(job->n)) != 0 || job->m < 2 || job->n < 2) {
+        sprintf(error, "edge file is not a PGM image");
+        return 0;
+    }
+    if (!serve_writable(job->output)) {
+        sprintf(error, "cannot write output file");
+        return 0;
+    }
+    job->processes = serve_processes(size, job->m, job->n);
+    return 1;
+}
+
+/**
+ * @brief Open the listening socket
+ * @param path the socket's path, replaced if it exists
+ * @return the socket, or -1 if it could not be opened
+ */
+static int serve_listen (char * path) {
+    int sock;
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Run the job server until it is told to quit. Called by every process
+ * @param path the socket's path
+ * @param rank the rank of the calling process in MPI_COMM_WORLD
+ * @param size the number of processes
+ * @param options the options for every solve, other than iterations and delta
+ */
+void serve (char * path, int rank, int size, reconstruct_options * options) {
+    int sock = -1, conn = -1, ok, c, next = 0, status;
+    char line[SERVE_LINE], error[SERVE_ERROR];
+    double t0, t1;
+    serve_job job;
+    serve_context contexts[SERVE_CONTEXTS];
+    reconstruct_context * context;
+    reconstruct_options job_options = *options;
+    reconstruct_result result;
+
+    memset(contexts, 0, sizeof(contexts));
+    job_options.step = 0;
+
+    if (rank == 0) {
+        if ((sock = serve_listen(path)) < 0) {
+            fprintf(stderr, "serve: cannot listen on <%s>\n", path);
+            m_abort();
+        }
+        printf("Serving on %s with %d processes\n", path, size);
+        fflush(stdout);
+    }
+
+    do {
+        /* rank 0 waits for a job that can run */
+        if (rank == 0) {
+            for (ok = 0; !ok; ) {
+                if ((conn = accept(sock, NULL, NULL)) < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    fprintf(stderr, "serve: accept failed: %s\n", strerror(errno));
+                    /* out of descriptors or memory may pass, anything else will not */
+                    if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM) m_abort();
+                    sleep(SERVE_BACKOFF);
+                    continue;
+                }
+                if (!serve_read_line(conn, line)) {
+                    close(conn);
+                    continue;
+                }
+                if (!(ok = serve_parse(line, &job, size, error))) {
+                    snprintf(line, sizeof(line), "error %s\n", error);
+                    serve_reply(conn, line);
+                    close(conn);
+                }
+            }
+            t0 = get_time();
+        }
+        broadcast(MPI_COMM_WORLD, &job, sizeof(job));
+        if (job.stop) break;
+
+        context = serve_context_for(contexts, &next, &job, rank);
+        status = 0;
+        if (context != NULL) {
+            job_options.iterations = job.iterations;
+            job_options.delta = job.delta;
+            /* every member gets the same status from loading and solving, so they stay in step */
+            if (reconstruct_load_file(context, job.edge) != 0) status = 1;
+            else if (reconstruct_solve(context, &job_options, &result) != 0) status = 2;
+            else if (reconstruct_save_file(context, job.output) != 0) status = 3;
+        }
+
+        if (rank == 0) {
+            t1 = get_time();
+            if (status == 1)
+                snprintf(line, sizeof(line), "error cannot read edge file\n");
+            else if (status == 2)
+                snprintf(line, sizeof(line), "error options do not suit a %d x %d image on %d processes\n",
+                    job.m, job.n, job.processes);
+            else if (status == 3)
+                snprintf(line, sizeof(line), "error cannot write output file\n");
+            else
+                snprintf(line, sizeof(line), "ok iterations %d delta %.16f solve %lf total %lf processes %d\n",
+                    result.iterations, result.delta, result.coarse_time + result.time, t1-t0, job.processes);
+            serve_reply(conn, line);
+            close(conn);
+            printf("%s -> %s: %s", job.edge, job.output, line);
+            fflush(stdout);
+        }
+    } while (1);
+
+    for (c = 0; c < SERVE_CONTEXTS; c++) {
+        if (contexts[c].context != NULL) reconstruct_destroy(contexts[c].context);
+    }
+
+    if (rank == 0) {
+        serve_reply(conn, "ok stopping\n");
+        close(conn);
+        close(sock);
+        unlink(path);
+    }
+}
+
+/**
+ * @brief Send a job to a server and print its reply. Needs no MPI
+ * @param path the server's socket
+ * @param edge the edge file, or NULL to stop the server
+ * @param output the output file
+ * @param iterations the maximum number of iterations
+ * @param delta the minimum delta value
+ * @return 0 if the server accepted the job, otherwise 1
+ */
+int submit (char * path, char * edge, char * output, int iterations, double delta) {
+    int sock;
+    char line[SERVE_LINE], cwd[SERVE_PATH];
+    char edge_path[SERVE_PATH], output_path[SERVE_PATH];
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "submit: cannot connect to <%s>\n", path);
+        return 1;
+    }
+
+    if (edge == NULL) {
+        snprintf(line, sizeof(line), "quit\n");
+    } else {
+        /* the server runs elsewhere, so give it full paths */
+        if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+        snprintf(edge_path, sizeof(edge_path), "%s%s%s", edge[0] == '/' ? "" : cwd, edge[0] == '/' ? "" : "/", edge);
+        snprintf(output_path, sizeof(output_path), "%s%s%s", output[0] == '/' ? "" : cwd, output[0] == '/' ? "" : "/", output);
+        snprintf(line, sizeof(line), "%s\t%s\t%d\t%.17g\n", edge_path, output_path, iterations, delta);
+    }
+    serve_reply(sock, line);
+
+    if (!serve_read_line(sock, line)) {
+        fprintf(stderr, "submit: no reply from <%s>\n", path);
+        close(sock);
+        return 1;
+    }
+    close(sock);
+
+    printf("%s\n", line);
+    return strncmp(line, "ok", 2) != 0;
+}
@@ -0,0 +1,229 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file snapshot.c
+ * @author James Clark
+ * @brief Writes the image every few iterations without holding up the solve.
+ *
+ * A snapshot copies each tile to a staging grid and starts a non-blocking reduce of
+ * the range of the image. Once that completes the staged tile is scaled to grey levels
+ * and a non-blocking gather to rank 0 is started, and once that completes rank 0 hands
+ * the image to a writer thread, which only touches the file and the gathered image.
+ * Each step is checked with MPI_Testall after every iteration, on a duplicate of the
+ * cartesian communicator so none of it can match the solve's messages. A snapshot
+ * still in flight when the next is due is finished first, so every rank starts each
+ * snapshot at the same iteration. A snapshot that would be gathered while the writer
+ * is still busy is dropped, rather than stalling rank 0 and with it every rank.
+ * There is only one set of snapshots per process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#include <grid.h>
+#include <pgmio.h>
+#include <trace.h>
+#include <precision.h>
+#include <functions.h>
+
+/** What the snapshot in flight is waiting for */
+enum {
+    SNAPSHOT_IDLE,    /**< There is no snapshot in flight */
+    SNAPSHOT_RANGE,   /**< Waiting for the range of the image */
+    SNAPSHOT_GATHER   /**< Waiting for the grey levels to reach rank 0 */
+};
+
+/** The snapshots of the running solve */
+static struct {
+    MPI_Comm comm;             /**< Duplicate of the cartesian communicator */
+    int rank;                  /**< The rank of this process */
+    int size;                  /**< The number of processes */
+    image_dimensions img_dim;  /**< The dimensions of the local and global data */
+    int every;                 /**< Iterations between snapshots */
+    int next;                  /**< The iteration the next snapshot is due at */
+    const char * pattern;      /**< printf pattern for the file name, given the iteration */
+    int state;                 /**< What the snapshot in flight is waiting for */
+    int iteration;             /**< The iteration of the snapshot in flight */
+    real ** stage;             /**< Copy of the tile being snapshot */
+    greynum ** grey;           /**< The staged tile as grey levels */
+    greynum ** global;         /**< The gathered image, only on rank 0 */
+    real range[3];             /**< The negated minimum, the maximum, and whether rank 0 is still writing */
+    real global_range[3];      /**< The reduced range */
+    MPI_Request * requests;    /**< The requests of the step in flight */
+    int count;                 /**< The number of requests */
+    char filename[FILENAME_MAX]; /**< The file being written */
+    pthread_t writer;          /**< The thread writing the last snapshot */
+    int writing;               /**< Whether the writer thread has been started and not joined */
+    int written;               /**< Whether the writer thread has finished */
+    pthread_mutex_t lock;      /**< Guards written */
+    int taken;                 /**< Snapshots gathered */
+    int skipped;               /**< Snapshots dropped because the writer was busy */
+    double time;               /**< Seconds spent in ::snapshot_tick */
+} snap = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Write the gathered image, run on the writer thread
+ * @param unused
+ * @return NULL
+ */
+static void * snapshot_writer (void * unused) {
+    pgmwritegrey(snap.filename, snap.global, snap.img_dim.m, snap.img_dim.n);
+
+    pthread_mutex_lock(&snap.lock);
+    snap.written = 1;
+    pthread_mutex_unlock(&snap.lock);
+    return NULL;
+}
+
+/**
+ * @brief Check if the writer thread is still writing, joining it if it has finished
+ * @param wait 1 to wait for it to finish
+ * @return 1 if it is still writing, otherwise 0
+ */
+static int snapshot_busy (int wait) {
+    int written;
+
+    if (!snap.writing) return 0;
+
+    pthread_mutex_lock(&snap.lock);
+    written = snap.written;
+    pthread_mutex_unlock(&snap.lock);
+    if (!written && !wait) return 1;
+
+    pthread_join(snap.writer, NULL);
+    snap.writing = 0;
+    return 0;
+}
+
+/**
+ * @brief Move the snapshot in flight on as far as it can go
+ * @param wait 1 to wait for it to be handed to the writer
+ */
+static void snapshot_progress (int wait) {
+    if (snap.state == SNAPSHOT_RANGE && requests_test(snap.count, snap.requests, wait)) {
+        if (snap.global_range[2] > 0.0) {
+            /* rank 0 could not take it, every rank knows from the reduce */
+            snap.skipped++;
+            snap.state = SNAPSHOT_IDLE;
+        } else {
+            grey_scale(snap.img_dim, snap.stage, -snap.global_range[0], snap.global_range[1], snap.grey);
+            gather_start(snap.comm, snap.rank, snap.size, snap.img_dim, snap.grey, snap.global, snap.requests, &(snap.count));
+            snap.state = SNAPSHOT_GATHER;
+        }
+    }
+
+    if (snap.state == SNAPSHOT_GATHER && requests_test(snap.count, snap.requests, wait)) {
+        if (snap.rank == 0) {
+            snprintf(snap.filename, sizeof(snap.filename), snap.pattern, snap.iteration);
+            snap.written = 0;
+            snap.writing = 1;
+            if (pthread_create(&snap.writer, NULL, snapshot_writer, NULL) != 0) {
+                /* no thread to spare, so write it now */
+                snapshot_writer(NULL);
+                snap.writing = 0;
+            }
+        }
+        snap.taken++;
+        snap.state = SNAPSHOT_IDLE;
+    }
+}
+
+/**
+ * @brief Start taking snapshots of a solve
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param size the number of processes in the communicator
+ * @param img_dim the dimensions of the local and global data
+ * @param every the number of iterations between snapshots
+ * @param pattern printf pattern for the file names, given the iteration, only used on rank 0
+ */
+void snapshot_open (MPI_Comm cart_comm, int rank, int size, image_dimensions img_dim, int every, const char * pattern) {
+    dup_comm(cart_comm, &(snap.comm));
+    snap.rank = rank;
+    snap.size = size;
+    snap.img_dim = img_dim;
+    snap.every = every;
+    snap.next = every;
+    snap.pattern = pattern;
+    snap.state = SNAPSHOT_IDLE;
+    snap.stage = (real **) grid_alloc(sizeof(real), img_dim.mp+2, img_dim.np+2);
+    snap.grey = (greynum **) grid_alloc(sizeof(greynum), img_dim.mp+2, img_dim.np+2);
+    snap.global = rank == 0 ? (greynum **) grid_alloc(sizeof(greynum), img_dim.m, img_dim.n) : NULL;
+    snap.requests = (MPI_Request *) malloc((size+1) * sizeof(MPI_Request));
+    snap.writing = 0;
+    snap.taken = 0;
+    snap.skipped = 0;
+    snap.time = 0.0;
+}
+
+/**
+ * @brief Move any snapshot in flight on, and start one if it is due. Call after every iteration
+ * @param iteration the number of iterations done
+ * @param old the local data after that many iterations
+ */
+void snapshot_tick (int iteration, real ** old) {
+    double t0 = get_time();
+    double t = trace_begin();
+    real xmin, xmax;
+
+    snapshot_progress(0);
+
+    if (iteration >= snap.next) {
+        snap.next = (iteration/snap.every + 1) * snap.every;
+        /* keep every rank starting snapshots together */
+        if (snap.state != SNAPSHOT_IDLE) snapshot_progress(1);
+
+        copy_tile(snap.img_dim, old, snap.stage);
+        grey_range(snap.img_dim, snap.stage, &xmin, &xmax);
+        snap.range[0] = -xmin;
+        snap.range[1] = xmax;
+        snap.range[2] = snap.rank == 0 ? (real) snapshot_busy(0) : 0.0;
+        snap.iteration = iteration;
+        reduce_start(snap.comm, MPI_MAX, snap.range, snap.global_range, 3, &(snap.requests[0]));
+        snap.count = 1;
+        snap.state = SNAPSHOT_RANGE;
+    }
+
+    trace_end("snapshot", t);
+    snap.time += get_time() - t0;
+}
+
+/**
+ * @brief Finish the snapshot in flight and the last write, then stop taking snapshots
+ * @param taken stores the number of snapshots written
+ * @param skipped stores the number of snapshots dropped because the writer was busy
+ * @return the seconds this process spent in ::snapshot_tick
+ */
+double snapshot_close (int * taken, int * skipped) {
+    snapshot_progress(1);
+    if (snap.rank == 0) snapshot_busy(1);
+
+    grid_free(snap.stage);
+    grid_free(snap.grey);
+    grid_free(snap.global);
+    free(snap.requests);
+    free_comm(&(snap.comm));
+
+    *taken = snap.taken;
+    *skipped = snap.skipped;
+    return snap.time;
+}
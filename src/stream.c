@@ -0,0 +1,185 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file stream.c
+ * @author James Clark
+ * @brief Reads a sequence of frames, one frame ahead of the reconstruction.
+ *
+ * A stream is either a container, a file holding several PGM images one after another,
+ * or a list file naming one PGM image per line. Every frame must have the same size.
+ * Only rank 0 reads the frames. Each read runs on a separate thread, which only touches
+ * the file and the frame buffer, so the main thread keeps making MPI calls while the
+ * next frame is loaded. There is only one stream per process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#include <pgmio.h>
+#include <precision.h>
+#include <functions.h>
+
+/** Longest file name in a list file */
+#define STREAM_PATH 4096
+
+/** The open stream */
+static struct {
+    FILE * file;               /**< The container or list file */
+    int container;             /**< 1 if the file holds the frames, 0 if it names them */
+    image_dimensions img_dim;  /**< The dimensions of every frame */
+    edgenum * frame;           /**< The buffer being read in to */
+    int found;                 /**< Whether the last read found a frame */
+    pthread_t reader;          /**< The thread doing the read */
+} stream;
+
+/**
+ * @brief Check if a file holds images, rather than naming them
+ * @param file the file to check, left at its start
+ * @return 1 if the file starts with a PGM header, otherwise 0
+ */
+static int stream_is_container (FILE * file) {
+    char magic[3] = "";
+
+    if (fscanf(file, " %2s", magic) != 1) magic[0] = '\0';
+    rewind(file);
+    return strcmp(magic, "P2") == 0;
+}
+
+/**
+ * @brief Read the next file name from a list file, skipping blank lines
+ * @param file the list file
+ * @param path stores the file name
+ * @return 1 if a file name was read, 0 at the end of the list
+ */
+static int stream_next_path (FILE * file, char * path) {
+    while (fgets(path, STREAM_PATH, file) != NULL) {
+        path[strcspn(path, "\r\n")] = '\0';
+        if (path[0] != '\0') return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the dimensions of the frames, from the first one
+ * @param filename the container or list file
+ * @param nx pointer to store the x dimension
+ * @param ny pointer to store the y dimension
+ */
+void stream_size (char * filename, int * nx, int * ny) {
+    FILE * file;
+    char path[STREAM_PATH];
+
+    if ((file = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "stream_size: cannot open <%s>\n", filename);
+        exit(-1);
+    }
+
+    if (stream_is_container(file)) {
+        image_size(filename, nx, ny);
+    } else if (stream_next_path(file, path)) {
+        image_size(path, nx, ny);
+    } else {
+        fprintf(stderr, "stream_size: no frames in <%s>\n", filename);
+        exit(-1);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Open a stream of frames. Only rank 0 should call this
+ * @param filename the container or list file
+ * @param img_dim the dimensions of every frame
+ */
+void stream_open (char * filename, image_dimensions img_dim) {
+    if ((stream.file = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "stream_open: cannot open <%s>\n", filename);
+        exit(-1);
+    }
+    stream.container = stream_is_container(stream.file);
+    stream.img_dim = img_dim;
+}
+
+/**
+ * @brief Read a frame named by a list file in to the stream's buffer
+ * @param path the frame's file name
+ */
+static void stream_read_path (char * path) {
+    FILE * file;
+
+    if ((file = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "stream_read: cannot open <%s>\n", path);
+        exit(-1);
+    }
+    if (!pgmreadedgefp(file, stream.frame, stream.img_dim.m, stream.img_dim.n)) {
+        fprintf(stderr, "stream_read: no image in <%s>\n", path);
+        exit(-1);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Read the next frame in to the stream's buffer, run on the reader thread
+ * @param unused
+ * @return NULL
+ */
+static void * stream_reader (void * unused) {
+    char path[STREAM_PATH];
+
+    if (stream.container) {
+        stream.found = pgmreadedgefp(stream.file, stream.frame, stream.img_dim.m, stream.img_dim.n);
+    } else {
+        stream.found = stream_next_path(stream.file, path);
+        if (stream.found) stream_read_path(path);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start reading the next frame in the background, see ::stream_wait
+ * @param frame the buffer to read the frame in to, in the order of the file, see ::reconstruct_load
+ */
+void stream_read (edgenum * frame) {
+    stream.frame = frame;
+    if (pthread_create(&stream.reader, NULL, stream_reader, NULL) != 0) {
+        /* no thread to spare, so read it now */
+        stream_reader(NULL);
+        stream.reader = pthread_self();
+    }
+}
+
+/**
+ * @brief Wait for the read started by ::stream_read to complete
+ * @return 1 if a frame was read, 0 at the end of the stream
+ */
+int stream_wait () {
+    if (!pthread_equal(stream.reader, pthread_self()))
+        pthread_join(stream.reader, NULL);
+    return stream.found;
+}
+
+/**
+ * @brief Close the stream
+ */
+void stream_close () {
+    fclose(stream.file);
+}
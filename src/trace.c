@@ -0,0 +1,166 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trace.c
+ * @author James Clark
+ * @brief Event timeline, written in the Chrome trace format that Perfetto can open.
+ *
+ * Each process records the start and end of its compute, halo, reduction and I/O
+ * events in a ring buffer that is allocated up front, so recording never allocates or
+ * locks. Once the buffer is full the oldest events are overwritten. At the end the
+ * clocks are corrected to rank 0's, and rank 0 writes every process's events to one
+ * file, with a track per rank. When tracing is off, each event costs one test of
+ * ::trace_enabled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include <precision.h>
+#include <functions.h>
+#include <trace.h>
+
+/** Longest event name written to the file */
+#define TRACE_NAME 24
+
+/** Whether events are being recorded */
+int trace_enabled = 0;
+
+/** A recorded event */
+typedef struct {
+    const char * name;   /**< The name of the event */
+    double start;        /**< When the event started */
+    double end;          /**< When the event ended */
+} trace_event;
+
+/** An event as sent to rank 0 */
+typedef struct {
+    char name[TRACE_NAME]; /**< The name of the event */
+    double start;          /**< When the event started, on rank 0's clock */
+    double duration;       /**< How long the event took */
+} trace_sent;
+
+/** The ring buffer */
+static trace_event * events = NULL;
+/** The number of events the ring buffer holds */
+static int capacity = 0;
+/** The number of events recorded, including those overwritten */
+static long recorded = 0;
+
+/**
+ * @brief Start recording events
+ * @param count the number of events to keep on each process
+ */
+void trace_init (int count) {
+    events = (trace_event *) malloc(count * sizeof(trace_event));
+    capacity = count;
+    recorded = 0;
+    trace_enabled = (events != NULL && count > 0);
+}
+
+/**
+ * @brief Record an event that ends now, see ::trace_end
+ * @param name the name of the event, which must be a string constant
+ * @param start when the event started
+ */
+void trace_record (const char * name, double start) {
+    trace_event * event = &events[recorded % capacity];
+
+    event->name = name;
+    event->start = start;
+    event->end = get_time();
+    recorded++;
+}
+
+/**
+ * @brief Stop recording, and write every process's events to a file. Called by every process
+ * @param comm the communicator of the processes
+ * @param rank the rank of the calling process in comm
+ * @param size the number of processes in comm
+ * @param filename the file for rank 0 to write
+ */
+void trace_write (MPI_Comm comm, int rank, int size, char * filename) {
+    int e, r, kept, first, total, processes, * counts;
+    double offset, base;
+    real dropped, total_dropped;
+    char * all;
+    trace_sent * sent, * event;
+    FILE * file;
+
+    trace_enabled = 0;
+
+    /* the oldest kept event is the next to be overwritten */
+    kept = recorded < capacity ? recorded : capacity;
+    first = recorded < capacity ? 0 : recorded % capacity;
+
+    offset = clock_offset(comm, rank, size);
+    sent = (trace_sent *) malloc((kept > 0 ? kept : 1) * sizeof(trace_sent));
+    for (e = 0; e < kept; e++) {
+        memset(sent[e].name, 0, TRACE_NAME);
+        strncpy(sent[e].name, events[(first + e) % capacity].name, TRACE_NAME - 1);
+        sent[e].start = events[(first + e) % capacity].start - offset;
+        sent[e].duration = events[(first + e) % capacity].end - events[(first + e) % capacity].start;
+    }
+
+    dropped = recorded - kept;
+    reduce(comm, MPI_SUM, &dropped, &total_dropped);
+
+    processes = size > 1 ? size : 1;
+    counts = (int *) malloc(processes * sizeof(int));
+    all = gather_bytes(comm, rank, size, sent, kept * sizeof(trace_sent), counts);
+
+    if (rank == 0) {
+        if ((file = fopen(filename, "w")) == NULL) {
+            fprintf(stderr, "trace_write: cannot open <%s>\n", filename);
+        } else {
+            /* start the timeline at the first event */
+            event = (trace_sent *) all;
+            base = 0.0;
+            for (r = 0, total = 0; r < processes; r++) total += counts[r] / sizeof(trace_sent);
+            for (e = 0; e < total; e++) {
+                if (e == 0 || event[e].start < base) base = event[e].start;
+            }
+
+            fprintf(file, "{\"traceEvents\":[\n");
+            for (r = 0; r < processes; r++) {
+                fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"rank %d\"}},\n", r, r);
+                for (e = 0; e < counts[r] / (int) sizeof(trace_sent); e++, event++) {
+                    fprintf(file, "{\"name\":\"%s\",\"cat\":\"reconstruct\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                        event->name, r, 1.e6*(event->start - base), 1.e6*event->duration);
+                }
+            }
+            fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"reconstruct\"}}\n");
+            fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+            fclose(file);
+
+            printf("Trace written to %s", filename);
+            if (total_dropped > 0) printf(", the oldest %.0f events were overwritten", total_dropped);
+            printf("\n");
+        }
+        free(all);
+    }
+
+    free(counts);
+    free(sent);
+    free(events);
+    events = NULL;
+}
@@ -0,0 +1,294 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tune.c
+ * @author James Clark
+ * @brief Chooses the process grid, tile depth and check interval by timing them.
+ *
+ * Each candidate is timed on a short solve of an image with no edges, which costs the
+ * same per iteration as a real image, and the fastest is kept. The parameters are
+ * searched one after another, each starting from the best of the ones before, rather
+ * than every combination. The choice is stored in a cache file, one line per image
+ * size, process count and host, so later runs on the same machine skip the search.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#include <grid.h>
+#include <precision.h>
+#include <functions.h>
+
+/** Iterations in each timed trial */
+#define TUNE_ITERATIONS 40
+/** A candidate must beat the best so far by this fraction to replace it */
+#define TUNE_MARGIN 0.02
+/** Longest host name kept in the cache */
+#define TUNE_HOST 256
+
+/** Candidate tile depths, the wavefront only helps when there is one process */
+static const int tune_depths[] = {2, 4, 8, 16};
+/** Candidate check intervals */
+static const int tune_intervals[] = {2, 4, 8, 16};
+
+/** One line of the tuning cache */
+typedef struct {
+    int m, n;               /**< The image dimensions */
+    int processes;          /**< The number of processes */
+    int dims[2];            /**< The process grid */
+    int tile_depth;         /**< The tile depth */
+    int check_interval;     /**< The check interval */
+    double time;            /**< Seconds per iteration */
+    int found;              /**< Whether this was found in the cache */
+} tune_entry;
+
+/**
+ * @brief Whether a tile depth above 1 can be used with the other options
+ * @param options the options
+ * @param size the number of processes
+ * @return 1 if it can, otherwise 0
+ */
+static int tune_depth_allowed (const reconstruct_options * options, int size) {
+    return size == 1 && options->active_block == 0 && !options->in_place && !options->async && options->balance == 0;
+}
+
+/**
+ * @brief Look up the tuning for an image size and process count. Only rank 0 should call this
+ * @param cache the cache file
+ * @param host the host name
+ * @param entry the image size and process count to look for, and stores the tuning
+ * @return 1 if the cache holds the tuning, otherwise 0
+ */
+static int tune_lookup (char * cache, char * host, tune_entry * entry) {
+    FILE * file;
+    char line[TUNE_HOST + 128], name[TUNE_HOST];
+    tune_entry e;
+    int found = 0;
+
+    if ((file = fopen(cache, "r")) == NULL) return 0;
+
+    /* the last matching line wins, so a retune replaces an older one */
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%255s %d %d %d %d %d %d %d %lf", name, &e.m, &e.n, &e.processes,
+                   &e.dims[0], &e.dims[1], &e.tile_depth, &e.check_interval, &e.time) != 9) continue;
+        if (strcmp(name, host) == 0 && e.m == entry->m && e.n == entry->n && e.processes == entry->processes) {
+            *entry = e;
+            found = 1;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+/**
+ * @brief Add a tuning to the cache. Only rank 0 should call this
+ * @param cache the cache file
+ * @param host the host name
+ * @param entry the tuning
+ */
+static void tune_store (char * cache, char * host, tune_entry * entry) {
+    FILE * file;
+    int new_file = access(cache, F_OK) != 0;
+
+    if ((file = fopen(cache, "a")) == NULL) {
+        fprintf(stderr, "tune: cannot write <%s>, the tuning will not be kept\n", cache);
+        return;
+    }
+    if (new_file)
+        fprintf(file, "# host m n processes dims_x dims_y tile_depth check_interval seconds_per_iteration\n");
+    fprintf(file, "%s %d %d %d %d %d %d %d %.9f\n", host, entry->m, entry->n, entry->processes,
+            entry->dims[0], entry->dims[1], entry->tile_depth, entry->check_interval, entry->time);
+    fclose(file);
+}
+
+/**
+ * @brief Time a solve on a context
+ * @param comm the communicator the context was created on
+ * @param context the context, with an image loaded
+ * @param options the options to time, overridden to run exactly TUNE_ITERATIONS silently
+ * @return the seconds per iteration of the slowest process
+ */
+static double tune_time (MPI_Comm comm, reconstruct_context * context, const reconstruct_options * options) {
+    reconstruct_options trial = *options;
+    reconstruct_result result;
+    real local, global;
+
+    trial.iterations = TUNE_ITERATIONS;
+    trial.delta = 0.0;
+    trial.step = 0;
+    trial.warm_start = 0;
+    trial.keep_guess = 0;
+
+    /* the first solve faults in the grids and sets up the halo swaps */
+    reconstruct_solve(context, &trial, &result);
+    reconstruct_solve(context, &trial, &result);
+
+    local = result.time / result.iterations;
+    reduce(comm, MPI_MAX, &local, &global);
+    return global;
+}
+
+/**
+ * @brief Create a context with a zero image loaded
+ * @param comm the communicator of the processes to use
+ * @param rank the rank of the calling process in comm
+ * @param entry the image size and process grid
+ * @return the context, or NULL if the grid does not fit
+ */
+static reconstruct_context * tune_context (MPI_Comm comm, int rank, tune_entry * entry) {
+    reconstruct_context * context = reconstruct_create_grid(comm, entry->m, entry->n, entry->dims);
+    edgenum * edge = NULL;
+
+    if (context == NULL) return NULL;
+    if (rank == 0) edge = (edgenum *) calloc(entry->m * entry->n, sizeof(edgenum));
+    reconstruct_load(context, edge);
+    free(edge);
+    return context;
+}
+
+/**
+ * @brief Pick the best of a list of values for one option, by timing each
+ * @param comm the communicator the context was created on
+ * @param context the context to time on
+ * @param options the options, with the best value of the option stored in to value
+ * @param value the option being tuned
+ * @param candidates the values to try, other than the current one
+ * @param count the number of candidates
+ * @param scale how much longer a solve runs with each candidate, as a factor of its time
+ * @param best the time of the current value, and stores the time of the best
+ * @param rank the rank of the calling process
+ * @param label the name of the option, for the progress output
+ */
+static void tune_option (MPI_Comm comm, reconstruct_context * context, reconstruct_options * options, int * value,
+                         const int * candidates, int count, double * scale, double * best, int rank, char * label) {
+    int c, current = *value;
+    double t;
+
+    for (c = 0; c < count; c++) {
+        *value = candidates[c];
+        t = tune_time(comm, context, options) * (scale == NULL ? 1.0 : scale[c]);
+        if (rank == 0) printf("Autotune: %s %d takes %.3f ms per iteration\n", label, candidates[c], 1.e3*t);
+        if (t < (1.0 - TUNE_MARGIN) * *best) {
+            *best = t;
+            current = candidates[c];
+        }
+    }
+    *value = current;
+}
+
+/**
+ * @brief Choose the process grid, tile depth and check interval for an image, from the
+ *        cache if it holds them, otherwise by timing candidates and adding them to the cache
+ * @param comm the communicator the image will be solved on
+ * @param rank the rank of the calling process in comm
+ * @param size the number of processes in comm
+ * @param m the width of the image
+ * @param n the height of the image
+ * @param cache the cache file, only used on rank 0
+ * @param options the options to tune, the tile depth and check interval are replaced
+ * @param dims stores the process grid
+ */
+void tune (MPI_Comm comm, int rank, int size, int m, int n, char * cache, reconstruct_options * options, int * dims) {
+    int p, c, count;
+    char host[TUNE_HOST];
+    double t, scale[sizeof(tune_intervals)/sizeof(tune_intervals[0])];
+    tune_entry entry, best;
+    reconstruct_context * context;
+
+    /* the serial build gives no size */
+    if (size < 1) size = 1;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.m = m;
+    entry.n = n;
+    entry.processes = size;
+    if (rank == 0) {
+        if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+        host[TUNE_HOST-1] = '\0';
+        entry.found = tune_lookup(cache, host, &entry);
+    }
+    broadcast(comm, &entry, sizeof(entry));
+
+    if (!entry.found) {
+        best = entry;
+        best.time = DBL_MAX;
+        best.tile_depth = 1;
+        best.check_interval = 1;
+        options->tile_depth = 1;
+        options->check_interval = 1;
+
+        /* every way of laying the processes out that splits the image evenly */
+        for (p = 1; p <= size; p++) {
+            if (size % p != 0 || m % p != 0 || n % (size/p) != 0) continue;
+            entry.dims[0] = p;
+            entry.dims[1] = size/p;
+            if ((context = tune_context(comm, rank, &entry)) == NULL) continue;
+            t = tune_time(comm, context, options);
+            reconstruct_destroy(context);
+            if (rank == 0) printf("Autotune: %d x %d processes takes %.3f ms per iteration\n", p, size/p, 1.e3*t);
+            if (t < best.time) {
+                best.time = t;
+                best.dims[0] = p;
+                best.dims[1] = size/p;
+            }
+        }
+        if (best.time == DBL_MAX) {
+            /* nothing fits, leave it to reconstruct_create to report */
+            dims[0] = dims[1] = 0;
+            return;
+        }
+
+        context = tune_context(comm, rank, &best);
+        if (tune_depth_allowed(options, size)) {
+            count = sizeof(tune_depths)/sizeof(tune_depths[0]);
+            tune_option(comm, context, options, &(options->tile_depth), tune_depths, count, NULL, &best.time, rank, "tile depth");
+        }
+        /* a check interval of c overshoots by (c-1)/2 iterations on average */
+        count = sizeof(tune_intervals)/sizeof(tune_intervals[0]);
+        for (c = 0; c < count; c++)
+            scale[c] = 1.0 + (tune_intervals[c] - 1) / (2.0 * options->iterations);
+        tune_option(comm, context, options, &(options->check_interval), tune_intervals, count, scale, &best.time, rank, "check interval");
+        reconstruct_destroy(context);
+
+        best.tile_depth = options->tile_depth;
+        best.check_interval = options->check_interval;
+        entry = best;
+        if (rank == 0) tune_store(cache, host, &entry);
+    }
+
+    /* the cache is kept per image, so may come from a run with other options */
+    if (entry.tile_depth > 1 && !tune_depth_allowed(options, size)) {
+        if (rank == 0) printf("Autotune: the cached tile depth %d does not suit these options, using 1\n", entry.tile_depth);
+        entry.tile_depth = 1;
+    }
+
+    dims[0] = entry.dims[0];
+    dims[1] = entry.dims[1];
+    options->tile_depth = entry.tile_depth;
+    options->check_interval = entry.check_interval;
+    if (rank == 0)
+        printf("Autotune: %s %d x %d processes, tile depth %d, check interval %d, %.3f ms per iteration\n",
+            entry.found ? "cached" : "chose", dims[0], dims[1], entry.tile_depth, entry.check_interval, 1.e3*entry.time);
+}
@@ -0,0 +1,246 @@
+/* * MPP Coursework - MPI Edge Reconstruction
+ * Copyright (C) 2015,2016 James Clark
+ *
+ * This file is part of MPP Coursework.
+ *
+ * MPP Coursework is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPP Coursework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MPP Coursework.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file warm.c
+ * @author James Clark
+ * @brief Multi-resolution warm start for the initial guess.
+ *
+ * Each coarse level halves the local image in both dimensions. The coarse edge data is
+ * the sum of the 2x2 fine pixels it covers, which keeps the scaling of the Laplacian
+ * for the doubled pixel spacing. Every level is solved on the same communicator with
+ * ::update_tick, starting from the coarsest, and its result is copied up to each of the
+ * 2x2 pixels of the next finer level as their initial guess. The sawtooth halos of the
+ * coarse levels are adjusted every iteration, see ::coarse_boundary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+
+#include <grid.h>
+#include <precision.h>
+#include <functions.h>
+
+/**
+ * @brief Sum each 2x2 block of the fine edge data in to the coarse edge data
+ * @param coarse_dim the dimensions of the coarse level
+ * @param fine the fine edge data
+ * @param coarse the coarse edge data
+ * @return the largest absolute sum
+ */
+static real restrict_edge (image_dimensions coarse_dim, edgenum ** fine, edgenum ** coarse) {
+    int i, j, sum;
+    real largest = 0.0;
+
+    for (i = 1; i < (coarse_dim.mp + 1); i++) {
+        for (j = 1; j < (coarse_dim.np + 1); j++) {
+            sum = fine[2*i-1][2*j-1] + fine[2*i-1][2*j] + fine[2*i][2*j-1] + fine[2*i][2*j];
+            if (abs(sum) > largest) largest = abs(sum);
+            /* only stored if every rank's sums fit, see ::warm_start */
+            coarse[i][j] = (edgenum) sum;
+        }
+    }
+    return largest;
+}
+
+/**
+ * @brief Copy each coarse pixel to the 2x2 fine pixels it covers
+ * @param fine_dim the dimensions of the fine level
+ * @param coarse the coarse data
+ * @param fine the fine data
+ */
+static void prolong (image_dimensions fine_dim, real ** coarse, real ** fine) {
+    int i, j;
+
+    for (i = 1; i < (fine_dim.mp + 1); i++) {
+        for (j = 1; j < (fine_dim.np + 1); j++) {
+            fine[i][j] = coarse[(i+1)/2][(j+1)/2];
+        }
+    }
+}
+
+/**
+ * @brief Move the sawtooth boundary of a coarse level back to where the fine boundary is.
+ *
+ * A coarse halo pixel is centred (scale-1)/2 fine pixels further out than the fine halo,
+ * which weakens the pull of the boundary and biases the whole solution. Setting the halo
+ * so that the line from it to the first pixel passes through the sawtooth value at the
+ * fine halo's position removes most of that bias.
+ * @param img_dim the dimensions of the coarse level
+ * @param old the coarse data
+ * @param low the sawtooth values for column 0, or NULL if this process does not own them
+ * @param high the sawtooth values for column np+1, or NULL if this process does not own them
+ * @param scale the number of fine pixels across a coarse pixel
+ */
+static void coarse_boundary (image_dimensions img_dim, real ** old, real * low, real * high, int scale) {
+    int i;
+    /* position of the fine halo between the coarse halo and the first coarse pixel */
+    real t = (scale - 1.0)/(2.0*scale);
+
+    for (i = 1; i < (img_dim.mp + 1); i++) {
+        if (low  != NULL) old[i][0] = (low[i] - t*old[i][1])/(1.0 - t);
+        if (high != NULL) old[i][img_dim.np+1] = (high[i] - t*old[i][img_dim.np])/(1.0 - t);
+    }
+}
+
+/**
+ * @brief Halve the tiles of an uneven partition, see balance.c
+ * @param cuts where the tiles start in one dim, ending with the size of the image, or NULL
+ * @param size the size of the image in that dim
+ * @return the halved cuts, or NULL if cuts is or a tile cannot be halved
+ */
+static int * halve_cuts (const int * cuts, int size) {
+    int c, k;
+    int * half;
+
+    if (cuts == NULL) return NULL;
+    for (c = 0; cuts[c] < size; c++);
+    half = (int *) malloc((c+1) * sizeof(int));
+    for (k = 0; k <= c; k++) {
+        if (cuts[k] % 2 != 0) {
+            free(half);
+            return NULL;
+        }
+        half[k] = cuts[k]/2;
+    }
+    return half;
+}
+
+/**
+ * @brief Make a warm initial guess by solving the problem at coarser resolutions
+ * @param cart_comm the cartesian communicator for the processes
+ * @param rank the rank of the process calling the function
+ * @param img_dim the dimensions of the local and global data
+ * @param edge stores the original edge data
+ * @param old stores the initial guess, with the sawtooth halos already set
+ * @param levels the number of coarse levels to use
+ * @param delta the minimum delta of the fine level, coarse levels stop at a scaled delta
+ * @param iterations the maximum number of iterations for each level
+ * @return the total number of iterations spent on the coarse levels
+ */
+int warm_start (MPI_Comm cart_comm, int rank, image_dimensions img_dim, edgenum ** edge, real ** old, int levels, real delta, int iterations) {
+    int i, k, d, iteration, total = 0;
+    int * cuts[levels+1][2];
+    real largest, global_largest, global_delta, level_delta;
+    step_return return_val;
+    image_dimensions dims[levels+1];
+    edgenum ** edges[levels+1];
+    real ** olds[levels+1];
+    real ** new;
+    real * low, * high;
+    int own_low, own_high;
+    /* the levels swap other grids, so keep their halo swaps apart from the context's */
+    update_state * state;
+
+    dims[0] = img_dim;
+    edges[0] = edge;
+    olds[0] = old;
+
+    /* build the coarse edge data, stopping if a level cannot be halved or overflows */
+    for (k = 1; k < levels+1; k++) {
+        if (dims[k-1].mp % 2 != 0 || dims[k-1].np % 2 != 0) break;
+
+        dims[k].m  = dims[k-1].m/2;
+        dims[k].n  = dims[k-1].n/2;
+        dims[k].mp = dims[k-1].mp/2;
+        dims[k].np = dims[k-1].np/2;
+
+        /* an uneven partition halves too, if every process's tile does, see balance.c */
+        for (d = 0; d < 2; d++) {
+            cuts[k][d] = halve_cuts(dims[k-1].cuts[d], d == 0 ? dims[k-1].m : dims[k-1].n);
+            dims[k].cuts[d] = cuts[k][d];
+        }
+        if ((dims[k-1].cuts[0] != NULL && cuts[k][0] == NULL) || (dims[k-1].cuts[1] != NULL && cuts[k][1] == NULL)) {
+            free(cuts[k][0]);
+            free(cuts[k][1]);
+            break;
+        }
+        edges[k] = (edgenum **) grid_alloc(sizeof(edgenum), dims[k].mp+2, dims[k].np+2);
+
+        largest = restrict_edge(dims[k], edges[k-1], edges[k]);
+        reduce(cart_comm, MPI_MAX, &largest, &global_largest);
+        if (global_largest > SHRT_MAX) {
+            grid_free(edges[k]);
+            free(cuts[k][0]);
+            free(cuts[k][1]);
+            break;
+        }
+    }
+    if (k-1 < levels && rank == 0)
+        printf("Warm start: using %d of %d coarse levels\n", k-1, levels);
+    levels = k-1;
+
+    boundary_sides(cart_comm, &own_low, &own_high);
+
+    /* solve from the coarsest level up, each warm started from the one below */
+    state = update_state_create();
+    for (k = levels; k > 0; k--) {
+        olds[k] = (real **) grid_alloc(sizeof(real), dims[k].mp+2, dims[k].np+2);
+        new     = (real **) grid_alloc(sizeof(real), dims[k].mp+2, dims[k].np+2);
+
+        setup_reconstruct(cart_comm, rank, dims[k], olds[k]);
+        if (k < levels) {
+            prolong(dims[k], olds[k+1], olds[k]);
+            grid_free(olds[k+1]);
+        }
+
+        /* keep the sawtooth values, the halos are adjusted from them */
+        low  = own_low  ? (real *) malloc((dims[k].mp+1) * sizeof(real)) : NULL;
+        high = own_high ? (real *) malloc((dims[k].mp+1) * sizeof(real)) : NULL;
+        for (i = 1; i < (dims[k].mp + 1); i++) {
+            if (low  != NULL) low[i]  = olds[k][i][0];
+            if (high != NULL) high[i] = olds[k][i][dims[k].np+1];
+        }
+
+        /* Jacobi converges 4 times faster per level, so the same error gives a 4 times larger delta */
+        level_delta = delta * (1 << (2*k));
+
+        global_delta = FLT_MAX;
+        for (iteration = 0; (iteration < iterations) && (global_delta > level_delta); iteration++) {
+            coarse_boundary(dims[k], olds[k], low, high, 1 << k);
+            return_val = update_tick(cart_comm, rank, dims[k], edges[k], olds[k], new, state);
+            reduce(cart_comm, MPI_MAX, &(return_val.delta), &global_delta);
+        }
+        free(low);
+        free(high);
+        if (rank == 0)
+            printf("Warm start: %d x %d solved in %d iterations\n", dims[k].m, dims[k].n, iteration);
+        total += iteration;
+
+        /* the swap points in to this level's grid */
+        halo_release(state);
+        grid_free(new);
+        grid_free(edges[k]);
+        free(cuts[k][0]);
+        free(cuts[k][1]);
+    }
+
+    update_state_free(state);
+
+    if (levels > 0) {
+        prolong(dims[0], olds[1], old);
+        grid_free(olds[1]);
+    }
+
+    return total;
+}